@@ -0,0 +1,413 @@
+#include "assets.h"
+#include "headers.h"
+#include "profiling.h"
+#include "spdlog/spdlog.h"
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+// Quiet period after the last filesystem event before changes are applied, so
+// that a redeploy is picked up as one batch.
+#define SETTLE_MS 100
+
+namespace fs = std::filesystem;
+
+namespace Assets {
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+std::optional<std::string> normalizePath(std::string_view url) {
+  std::string decoded;
+  decoded.reserve(url.size());
+  for (size_t i = 0; i < url.size(); i++) {
+    char c = url[i];
+    if (c == '%') {
+      if (i + 2 >= url.size()) {
+        return std::nullopt;
+      }
+      int hi = hexValue(url[i + 1]);
+      int lo = hexValue(url[i + 2]);
+      if (hi < 0 || lo < 0) {
+        return std::nullopt;
+      }
+      c = (char)(hi * 16 + lo);
+      i += 2;
+    }
+
+    if (c == '\0') {
+      return std::nullopt;
+    }
+    decoded.push_back(c);
+  }
+
+  std::vector<std::string_view> segments;
+  std::string_view rest(decoded);
+  while (!rest.empty()) {
+    auto slash = rest.find('/');
+    auto segment = rest.substr(0, slash);
+    rest = slash == std::string_view::npos ? std::string_view()
+                                           : rest.substr(slash + 1);
+    if (segment.empty() || segment == ".") {
+      continue;
+    } else if (segment == "..") {
+      if (segments.empty()) {
+        return std::nullopt;
+      }
+      segments.pop_back();
+    } else {
+      segments.push_back(segment);
+    }
+  }
+
+  std::string path;
+  for (const auto &segment : segments) {
+    path += '/';
+    path += segment;
+  }
+  return path.empty() ? "/" : path;
+}
+
+static std::string etag(const std::string &data) {
+  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : data) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+
+  char buf[19];
+  std::snprintf(buf, sizeof(buf), "\"%016" PRIx64 "\"", hash);
+  return buf;
+}
+
+static std::shared_ptr<const std::string> gzip(const std::string &data) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  // windowBits + 16 selects the gzip wrapper
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return nullptr;
+  }
+
+  std::string out(deflateBound(&zs, data.size()), '\0');
+  zs.next_in = (Bytef *)data.data();
+  zs.avail_in = data.size();
+  zs.next_out = (Bytef *)&out[0];
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  if (ret != Z_STREAM_END || out.size() >= data.size()) {
+    return nullptr;
+  }
+  return std::make_shared<const std::string>(std::move(out));
+}
+
+std::shared_ptr<const Asset> loadAsset(const fs::path &file,
+                                       uintmax_t maxSize) {
+  PROFILE_SCOPE("Assets::loadAsset");
+  std::error_code ec;
+  auto size = fs::file_size(file, ec);
+  if (!ec && size > maxSize) {
+    SPDLOG_WARN("Not serving {}: {} bytes exceeds the limit of {}",
+                file.string(), size, maxSize);
+    return nullptr;
+  }
+
+  std::ifstream in(file, std::ios::binary);
+  if (ec || !in) {
+    SPDLOG_WARN("Unable to read {}", file.string());
+    return nullptr;
+  }
+
+  auto content = std::make_shared<const std::string>(
+      std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  auto asset = std::make_shared<Asset>();
+  asset->Content = content;
+  asset->ETag = etag(*content);
+  if (!Http::isCompressed(file.filename().string())) {
+    asset->Gzipped = gzip(*content);
+    asset->GzippedETag = asset->ETag;
+    asset->GzippedETag.insert(asset->GzippedETag.size() - 1, "-gz");
+  }
+  return asset;
+}
+
+// Absolute and without a trailing separator, so that the root can also be
+// watched by name from its parent directory.
+static fs::path absoluteDir(const fs::path &dir) {
+  auto abs = fs::absolute(dir).lexically_normal();
+  return abs.has_filename() ? abs : abs.parent_path();
+}
+
+static std::string relativePath(const fs::path &root, const fs::path &file) {
+  return "/" + file.lexically_relative(root).generic_string();
+}
+
+static bool isHidden(const std::string &path) {
+  return path.find("/.") != std::string::npos;
+}
+
+static void loadDirectory(const fs::path &root, const fs::path &dir,
+                          uintmax_t maxFileSize, AssetSet &assets) {
+  std::error_code ec;
+  fs::recursive_directory_iterator it(dir, ec), end;
+  for (; !ec && it != end; it.increment(ec)) {
+    if (it->path().filename().string().rfind('.', 0) == 0) {
+      if (it->is_directory(ec)) {
+        it.disable_recursion_pending();
+      }
+      continue;
+    } else if (!it->is_regular_file(ec)) {
+      continue;
+    }
+
+    auto asset = loadAsset(it->path(), maxFileSize);
+    if (asset) {
+      assets[relativePath(root, it->path())] = asset;
+    }
+  }
+
+  if (ec) {
+    SPDLOG_WARN("Unable to scan {}: {}", dir.string(), ec.message());
+  }
+}
+
+AssetCache::AssetCache(fs::path root, uintmax_t maxFileSize)
+    : root(absoluteDir(root)), maxFileSize(maxFileSize) {
+  auto assets = std::make_shared<AssetSet>();
+  loadDirectory(this->root, this->root, this->maxFileSize, *assets);
+  SPDLOG_INFO("Loaded {} assets from {}", assets->size(), this->root.string());
+  this->assets = std::move(assets);
+}
+
+AssetCache::~AssetCache() {
+  if (this->watcher.joinable()) {
+    if (write(this->stopPipe[1], "x", 1) == 1) {
+      this->watcher.join();
+    } else {
+      this->watcher.detach();
+    }
+  }
+
+  for (int fd : {this->inotifyFd, this->stopPipe[0], this->stopPipe[1]}) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+void AssetCache::addWatches(const std::string &dir) {
+  auto path = dir == "/" ? this->root : this->root / dir.substr(1);
+  int wd = inotify_add_watch(this->inotifyFd, path.c_str(),
+                             IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                 IN_MOVE_SELF | IN_ONLYDIR);
+  if (wd < 0) {
+    SPDLOG_WARN("Unable to watch {}: {}", path.string(), std::strerror(errno));
+    return;
+  }
+  this->watches[wd] = dir;
+
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(path, ec)) {
+    auto child = relativePath(this->root, entry.path());
+    if (entry.is_directory(ec) && !entry.is_symlink(ec) && !isHidden(child)) {
+      this->addWatches(child);
+    }
+  }
+}
+
+void AssetCache::removeWatches(const std::string &dir) {
+  auto prefix = dir + "/";
+  for (auto it = this->watches.begin(); it != this->watches.end();) {
+    if (it->second == dir || it->second.rfind(prefix, 0) == 0) {
+      inotify_rm_watch(this->inotifyFd, it->first);
+      it = this->watches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Drops every watch and starts over from the root, for when events were lost
+// or the root was replaced. Returns false if the root no longer exists.
+bool AssetCache::rewatch() {
+  for (const auto &watch : this->watches) {
+    inotify_rm_watch(this->inotifyFd, watch.first);
+  }
+  this->watches.clear();
+
+  this->addWatches("/");
+  if (this->watches.empty()) {
+    SPDLOG_ERROR("{} is gone, still serving the files loaded from it",
+                 this->root.string());
+    return false;
+  }
+  return true;
+}
+
+bool AssetCache::watch() {
+  this->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (this->inotifyFd < 0 || pipe(this->stopPipe) != 0) {
+    SPDLOG_ERROR("Unable to watch {}: {}", this->root.string(),
+                 std::strerror(errno));
+    return false;
+  }
+
+  this->addWatches("/");
+  if (this->watches.empty()) {
+    return false;
+  }
+
+  auto parent = this->root.parent_path();
+  this->parentWatch = inotify_add_watch(this->inotifyFd, parent.c_str(),
+                                        IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+  if (this->parentWatch < 0) {
+    SPDLOG_WARN("Unable to watch {}, replacing {} will go unnoticed: {}",
+                parent.string(), this->root.string(), std::strerror(errno));
+  }
+
+  this->watcher = std::thread([this]() { this->watchLoop(); });
+  return true;
+}
+
+void AssetCache::watchLoop() {
+  alignas(struct inotify_event) char buf[4096];
+  std::unordered_set<std::string> changed;
+  bool lost = false; // watches must be rebuilt before anything is reloaded
+  pollfd fds[2] = {{this->inotifyFd, POLLIN, 0},
+                   {this->stopPipe[0], POLLIN, 0}};
+
+  while (true) {
+    int n = poll(fds, 2, changed.empty() && !lost ? -1 : SETTLE_MS);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      SPDLOG_ERROR("Stopped watching {}: {}", this->root.string(),
+                   std::strerror(errno));
+      return;
+    } else if (fds[1].revents) {
+      return;
+    } else if (n == 0) {
+      if (lost) {
+        // Watches come first so that nothing changing during the full
+        // reload is missed.
+        lost = false;
+        changed = {"/"};
+        if (!this->rewatch()) {
+          changed.clear();
+        }
+      }
+      if (!changed.empty()) {
+        this->reload(changed);
+        changed.clear();
+      }
+      continue;
+    }
+
+    ssize_t len;
+    while ((len = read(this->inotifyFd, buf, sizeof(buf))) > 0) {
+      for (char *p = buf; p < buf + len;) {
+        auto *event = (struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+          lost = true;
+          continue;
+        } else if (event->wd == this->parentWatch) {
+          lost |= event->len > 0 && this->root.filename() == event->name;
+          continue;
+        }
+
+        const auto &dir = this->watches.find(event->wd);
+        if (dir == this->watches.end()) {
+          continue;
+        } else if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+          // Other directories going away are reported by their parent.
+          if (dir->second == "/") {
+            lost = true;
+          } else if (event->mask & IN_IGNORED) {
+            this->watches.erase(dir);
+          }
+          continue;
+        } else if (event->len == 0) {
+          continue;
+        }
+
+        auto path =
+            (dir->second == "/" ? "" : dir->second) + "/" + event->name;
+        if (isHidden(path)) {
+          continue;
+        } else if (event->mask & IN_ISDIR) {
+          if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            this->removeWatches(path);
+          } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            this->addWatches(path);
+          }
+        } else if (event->mask & IN_CREATE) {
+          continue; // wait for IN_CLOSE_WRITE
+        }
+        changed.insert(path);
+      }
+    }
+  }
+}
+
+void AssetCache::reload(const std::unordered_set<std::string> &paths) {
+  PROFILE_SCOPE("AssetCache::reload");
+  std::lock_guard lock(this->reloadMutex);
+  auto next = std::make_shared<AssetSet>(*this->snapshot());
+  for (const auto &path : paths) {
+    auto file = path == "/" ? this->root : this->root / path.substr(1);
+
+    // Drop the path and anything below it, then load whatever exists now.
+    auto prefix = path == "/" ? path : path + "/";
+    next->erase(path);
+    for (auto it = next->begin(); it != next->end();) {
+      it = it->first.rfind(prefix, 0) == 0 ? next->erase(it) : std::next(it);
+    }
+
+    std::error_code ec;
+    if (isHidden(path)) {
+      continue;
+    } else if (fs::is_directory(file, ec)) {
+      loadDirectory(this->root, file, this->maxFileSize, *next);
+    } else if (fs::is_regular_file(file, ec)) {
+      auto asset = loadAsset(file, this->maxFileSize);
+      if (asset) {
+        (*next)[path] = asset;
+      }
+    }
+    SPDLOG_INFO("Reloaded {}", path);
+  }
+
+  std::atomic_store(&this->assets, std::shared_ptr<const AssetSet>(next));
+}
+
+std::shared_ptr<const Asset> AssetCache::find(const std::string &path) const {
+  auto assets = this->snapshot();
+  const auto &entry = assets->find(path);
+  return entry != assets->end() ? entry->second : nullptr;
+}
+
+std::shared_ptr<const AssetSet> AssetCache::snapshot() const {
+  return std::atomic_load(&this->assets);
+}
+
+} // namespace Assets
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Assets {
+
+struct Asset {
+  std::shared_ptr<const std::string> Content;
+  std::shared_ptr<const std::string> Gzipped; // null if it would not be smaller
+  std::string ETag;
+  std::string GzippedETag; // each encoding needs its own strong validator
+};
+
+// Files larger than this are not cached, and so not served.
+constexpr uintmax_t DefaultMaxFileSize = 16 * 1024 * 1024;
+
+// Keyed by normalized path, e.g. "/static/js/main.js".
+typedef std::unordered_map<std::string, std::shared_ptr<const Asset>> AssetSet;
+
+// Percent-decodes a request path and resolves "." and ".." segments. Returns
+// nullopt for malformed paths and paths that would escape the serving root.
+std::optional<std::string> normalizePath(std::string_view url);
+
+// Reads, hashes and compresses a file. Returns nullptr if it cannot be read or
+// is larger than maxSize.
+std::shared_ptr<const Asset>
+loadAsset(const std::filesystem::path &file,
+          uintmax_t maxSize = DefaultMaxFileSize);
+
+// In-memory copy of every file under a directory, except hidden ones (any
+// path segment starting with a dot) and files over the size limit. Lookups
+// read an immutable snapshot; changes are applied by building a new snapshot
+// and swapping it in, so requests never observe a partially updated set.
+class AssetCache {
+private:
+  std::filesystem::path root;
+  uintmax_t maxFileSize;
+  std::shared_ptr<const AssetSet> assets;
+  std::mutex reloadMutex;
+
+  int inotifyFd = -1;
+  int stopPipe[2] = {-1, -1};
+  std::unordered_map<int, std::string> watches; // descriptor -> directory
+  int parentWatch = -1; // sees the root itself being replaced
+  std::thread watcher;
+
+  void addWatches(const std::string &dir);
+  void removeWatches(const std::string &dir);
+  bool rewatch();
+  void watchLoop();
+
+public:
+  explicit AssetCache(std::filesystem::path root,
+                      uintmax_t maxFileSize = DefaultMaxFileSize);
+  ~AssetCache();
+
+  AssetCache(const AssetCache &) = delete;
+  AssetCache &operator=(const AssetCache &) = delete;
+
+  // Starts reloading changed files from a background thread. Returns false if
+  // the directory could not be watched. The root may be replaced while
+  // watched, e.g. by renaming a new build into place or swapping a symlink.
+  bool watch();
+
+  // Re-reads the given normalized paths, dropping those (and anything below
+  // them) that no longer exist.
+  void reload(const std::unordered_set<std::string> &paths);
+
+  std::shared_ptr<const Asset> find(const std::string &path) const;
+  std::shared_ptr<const AssetSet> snapshot() const;
+};
+
+} // namespace Assets
@@ -0,0 +1,210 @@
+#include "assets.h"
+#include "http_testutils.h"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+namespace Assets {
+
+static std::string gunzip(const std::string &data) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  inflateInit2(&zs, 15 + 16);
+  std::string out(64 * 1024, '\0');
+  zs.next_in = (Bytef *)data.data();
+  zs.avail_in = data.size();
+  zs.next_out = (Bytef *)&out[0];
+  zs.avail_out = out.size();
+  inflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  inflateEnd(&zs);
+  return out;
+}
+
+// Polls until the cache holds the expected content for path.
+static bool waitForContent(const AssetCache &cache, const std::string &path,
+                           const std::optional<std::string> &expected) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    auto asset = cache.find(path);
+    if (expected ? asset && *asset->Content == *expected : !asset) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+TEST(Assets, NormalizePath) {
+  ASSERT_EQ(normalizePath("/"), "/");
+  ASSERT_EQ(normalizePath(""), "/");
+  ASSERT_EQ(normalizePath("/index.html"), "/index.html");
+  ASSERT_EQ(normalizePath("//static/./js//main.js"), "/static/js/main.js");
+  ASSERT_EQ(normalizePath("/static/js/../css/main.css"),
+            "/static/css/main.css");
+  ASSERT_EQ(normalizePath("/static/"), "/static");
+  ASSERT_EQ(normalizePath("/my%20file.txt"), "/my file.txt");
+  ASSERT_EQ(normalizePath("/static/%2E%2E/index.html"), "/index.html");
+}
+
+TEST(Assets, NormalizePathRejectsTraversal) {
+  ASSERT_FALSE(normalizePath("/.."));
+  ASSERT_FALSE(normalizePath("/../etc/passwd"));
+  ASSERT_FALSE(normalizePath("/static/../../etc/passwd"));
+  ASSERT_FALSE(normalizePath("/%2e%2e/etc/passwd"));
+  ASSERT_FALSE(normalizePath("/%2e%2e%2fetc%2fpasswd"));
+  ASSERT_FALSE(normalizePath("/index.html%00.js"));
+  ASSERT_FALSE(normalizePath("/abc%2"));
+  ASSERT_FALSE(normalizePath("/abc%zz"));
+}
+
+TEST(Assets, LoadDirectory) {
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  std::string html(4096, 'a');
+  dir.write("index.html", html);
+  dir.write("static/js/main.js", "console.log('hi');");
+
+  AssetCache cache(dir.path);
+  ASSERT_EQ(cache.snapshot()->size(), (size_t)2);
+
+  auto index = cache.find("/index.html");
+  ASSERT_TRUE(index);
+  ASSERT_EQ(*index->Content, html);
+  ASSERT_TRUE(index->Gzipped);
+  ASSERT_EQ(gunzip(*index->Gzipped), html);
+  ASSERT_EQ(index->ETag.size(), (size_t)18);
+  ASSERT_EQ(index->GzippedETag,
+            index->ETag.substr(0, index->ETag.size() - 1) + "-gz\"");
+
+  auto js = cache.find("/static/js/main.js");
+  ASSERT_TRUE(js);
+  ASSERT_EQ(*js->Content, "console.log('hi');");
+  ASSERT_FALSE(js->Gzipped); // too small to benefit
+  ASSERT_NE(js->ETag, index->ETag);
+
+  ASSERT_FALSE(cache.find("/missing.html"));
+}
+
+TEST(Assets, LoadDirectorySkipsFiles) {
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  dir.write("index.html", "hello");
+  dir.write(".env", "SECRET=1");
+  dir.write(".git/config", "[core]");
+  dir.write("static/.hidden.js", "hidden");
+  dir.write("large.js", std::string(2048, 'x'));
+  dir.write("logo.png", std::string(4096, 'p'));
+
+  AssetCache cache(dir.path, 1024);
+  ASSERT_TRUE(cache.find("/index.html"));
+  ASSERT_FALSE(cache.find("/.env"));
+  ASSERT_FALSE(cache.find("/.git/config"));
+  ASSERT_FALSE(cache.find("/static/.hidden.js"));
+  ASSERT_FALSE(cache.find("/large.js"));
+
+  // Already-compressed types are never gzipped, however well they'd shrink.
+  AssetCache unlimited(dir.path);
+  auto png = unlimited.find("/logo.png");
+  ASSERT_TRUE(png);
+  ASSERT_FALSE(png->Gzipped);
+  ASSERT_TRUE(unlimited.find("/large.js")->Gzipped);
+}
+
+TEST(Assets, ReloadSwapsChangedFiles) {
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  dir.write("index.html", "v1");
+  dir.write("static/a.js", "a");
+  dir.write("static/b.js", "b");
+
+  AssetCache cache(dir.path);
+  auto before = cache.snapshot();
+  auto oldIndex = cache.find("/index.html");
+
+  dir.write("index.html", "v2");
+  std::filesystem::remove_all(dir.path / "static");
+  cache.reload({"/index.html", "/static"});
+
+  ASSERT_EQ(*cache.find("/index.html")->Content, "v2");
+  ASSERT_NE(cache.find("/index.html")->ETag, oldIndex->ETag);
+  ASSERT_FALSE(cache.find("/static/a.js"));
+  ASSERT_FALSE(cache.find("/static/b.js"));
+
+  // Requests still holding the old snapshot are unaffected.
+  ASSERT_EQ(*oldIndex->Content, "v1");
+  ASSERT_EQ(before->size(), (size_t)3);
+}
+
+TEST(Assets, WatchReloadsChangedFiles) {
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  dir.write("index.html", "v1");
+
+  AssetCache cache(dir.path);
+  if (!cache.watch()) {
+    GTEST_SKIP() << "inotify unavailable";
+  }
+
+  dir.write("index.html", "v2");
+  ASSERT_TRUE(waitForContent(cache, "/index.html", "v2"));
+
+  dir.write("static/js/main.js", "new bundle");
+  ASSERT_TRUE(waitForContent(cache, "/static/js/main.js", "new bundle"));
+
+  dir.write(".tmp", "partial upload");
+  dir.write("static/js/main.js", "newer bundle");
+  ASSERT_TRUE(waitForContent(cache, "/static/js/main.js", "newer bundle"));
+  ASSERT_FALSE(cache.find("/.tmp"));
+
+  std::filesystem::remove(dir.path / "index.html");
+  ASSERT_TRUE(waitForContent(cache, "/index.html", std::nullopt));
+}
+
+TEST(Assets, WatchFollowsReplacedRoot) {
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  dir.write("build/index.html", "v1");
+
+  AssetCache cache(dir.path / "build");
+  if (!cache.watch()) {
+    GTEST_SKIP() << "inotify unavailable";
+  }
+
+  // Moving a new build into place, then changing it, including in a new
+  // directory.
+  std::filesystem::rename(dir.path / "build", dir.path / "old");
+  dir.write("next/index.html", "v2");
+  std::filesystem::rename(dir.path / "next", dir.path / "build");
+  ASSERT_TRUE(waitForContent(cache, "/index.html", "v2"));
+
+  dir.write("build/static/js/main.js", "bundle");
+  ASSERT_TRUE(waitForContent(cache, "/static/js/main.js", "bundle"));
+}
+
+TEST(Assets, WatchFollowsSwappedSymlink) {
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  dir.write("v1/index.html", "v1");
+  dir.write("v2/index.html", "v2");
+  std::filesystem::create_directory_symlink("v1", dir.path / "current");
+
+  AssetCache cache(dir.path / "current");
+  if (!cache.watch()) {
+    GTEST_SKIP() << "inotify unavailable";
+  }
+
+  // Swapped atomically, the way deploy tools do it.
+  std::filesystem::create_directory_symlink("v2", dir.path / "next");
+  std::filesystem::rename(dir.path / "next", dir.path / "current");
+  ASSERT_TRUE(waitForContent(cache, "/index.html", "v2"));
+
+  dir.write("v2/index.html", "v2.1");
+  ASSERT_TRUE(waitForContent(cache, "/index.html", "v2.1"));
+  dir.write("v1/index.html", "v1.1");
+  dir.write("v2/static/main.js", "bundle");
+  ASSERT_TRUE(waitForContent(cache, "/static/main.js", "bundle"));
+  ASSERT_EQ(*cache.find("/index.html")->Content, "v2.1");
+}
+
+} // namespace Assets
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+namespace Http {
+
+struct Header {
+  std::string_view Key;
+  std::string_view Value;
+};
+
+template <size_t N> using HeaderBlock = std::array<Header, N>;
+
+template <typename HttpResponse, size_t N>
+static HttpResponse *writeHeaders(HttpResponse *res,
+                                  const HeaderBlock<N> &headers) {
+  for (const auto &h : headers) {
+    res->writeHeader(h.Key, h.Value);
+  }
+  return res;
+}
+
+namespace Headers {
+
+constexpr HeaderBlock<1> Cors{{{"Access-Control-Allow-Origin", "*"}}};
+
+constexpr HeaderBlock<2> Json{{{"Access-Control-Allow-Origin", "*"},
+                               {"Content-Type", "application/json"}}};
+
+constexpr HeaderBlock<2> Trace{
+    {{"Content-Type", "application/json"},
+     {"Content-Disposition", "attachment; filename=\"trace.json\""}}};
+
+// Bundles with a content hash in their name never change, so browsers may
+// keep them for a year. Everything else, index.html in particular, must be
+// revalidated so that redeploys are picked up.
+constexpr std::string_view ImmutableCacheControl =
+    "public, max-age=31536000, immutable";
+constexpr std::string_view DefaultCacheControl = "no-cache";
+
+} // namespace Headers
+
+struct MimeType {
+  std::string_view Ext;
+  std::string_view Type;
+  bool Compressed; // gzip would not shrink it meaningfully
+};
+
+constexpr std::array<MimeType, 26> MimeTypes{{
+    {".html", "text/html", false},
+    {".htm", "text/html", false},
+    {".css", "text/css", false},
+    {".js", "text/javascript", false},
+    {".mjs", "text/javascript", false},
+    {".json", "application/json", false},
+    {".map", "application/json", false},
+    {".webmanifest", "application/manifest+json", false},
+    {".txt", "text/plain", false},
+    {".xml", "application/xml", false},
+    {".ico", "image/x-icon", false},
+    {".svg", "image/svg+xml", false},
+    {".png", "image/png", true},
+    {".jpg", "image/jpeg", true},
+    {".jpeg", "image/jpeg", true},
+    {".gif", "image/gif", true},
+    {".webp", "image/webp", true},
+    {".avif", "image/avif", true},
+    {".woff", "font/woff", true},
+    {".woff2", "font/woff2", true},
+    {".ttf", "font/ttf", false},
+    {".otf", "font/otf", false},
+    {".eot", "application/vnd.ms-fontobject", false},
+    {".wasm", "application/wasm", false},
+    {".pdf", "application/pdf", true},
+    {".mp4", "video/mp4", true},
+}};
+
+// Returns the extension of the last path segment including the dot, or an
+// empty view if there is none.
+constexpr std::string_view extension(std::string_view path) {
+  auto name = path.substr(path.rfind('/') + 1);
+  auto dot = name.rfind('.');
+  return dot == std::string_view::npos ? std::string_view()
+                                       : name.substr(dot);
+}
+
+// Returns an empty view for unknown extensions.
+constexpr std::string_view mimeType(std::string_view path) {
+  auto ext = extension(path);
+  for (const auto &m : MimeTypes) {
+    if (m.Ext == ext) {
+      return m.Type;
+    }
+  }
+  return {};
+}
+
+// Whether the file is already compressed, so gzipping it is wasted effort.
+constexpr bool isCompressed(std::string_view path) {
+  auto ext = extension(path);
+  for (const auto &m : MimeTypes) {
+    if (m.Ext == ext) {
+      return m.Compressed;
+    }
+  }
+  return false;
+}
+
+constexpr bool isHex(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
+
+// Directories react-scripts writes content-hashed bundles to. Anything else,
+// say /report.20240101.pdf, may be changed in place.
+constexpr std::array<std::string_view, 3> HashedAssetDirs{
+    "/static/js/", "/static/css/", "/static/media/"};
+
+// Whether the file is build output whose name carries a content hash the way
+// react-scripts names it, e.g. main.1a2b3c4d.chunk.js or logo.6ce24c58.svg.
+constexpr bool isHashedAsset(std::string_view path) {
+  bool inHashedDir = false;
+  for (auto dir : HashedAssetDirs) {
+    inHashedDir = inHashedDir || path.substr(0, dir.size()) == dir;
+  }
+  if (!inHashedDir) {
+    return false;
+  }
+
+  auto name = path.substr(path.rfind('/') + 1);
+  size_t start = name.find('.');
+  while (start != std::string_view::npos) {
+    size_t end = name.find('.', start + 1);
+    if (end == std::string_view::npos) {
+      return false; // last segment is the extension
+    }
+
+    auto segment = name.substr(start + 1, end - start - 1);
+    bool hex = segment.size() >= 8;
+    for (char c : segment) {
+      hex = hex && isHex(c);
+    }
+    if (hex) {
+      return true;
+    }
+    start = end;
+  }
+  return false;
+}
+
+static_assert(mimeType("/index.html") == "text/html");
+static_assert(mimeType("/static/js/main.1a2b3c4d.chunk.js") ==
+              "text/javascript");
+static_assert(mimeType("/static.d/README").empty());
+static_assert(isCompressed("/static/media/font.0123abcd.woff2"));
+static_assert(!isCompressed("/index.html"));
+static_assert(isHashedAsset("/static/media/logo.6ce24c58.svg"));
+static_assert(!isHashedAsset("/index.html"));
+static_assert(!isHashedAsset("/data.deadbeef.json"));
+
+// Headers for a static file, resolved without allocating.
+template <typename HttpResponse>
+static HttpResponse *writeFileHeaders(HttpResponse *res,
+                                      std::string_view path) {
+  auto type = mimeType(path);
+  if (!type.empty()) {
+    res->writeHeader("Content-Type", type);
+  }
+  return res->writeHeader("Cache-Control",
+                          isHashedAsset(path) ? Headers::ImmutableCacheControl
+                                              : Headers::DefaultCacheControl);
+}
+
+} // namespace Http
@@ -5,15 +5,126 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <vector>
 
+#include "assets.h"
+#include "headers.h"
 #include "products.h"
+#include "profiling.h"
 
 namespace Http {
 
+// Streams a response body with tryEnd in chunks of at most chunkSize bytes.
+// When the client cannot keep up, writing resumes from onWritable instead of
+// handing the rest of the body to the socket buffer, so a connection never
+// holds more than one chunk of unsent data. Bodies sent to many clients
+// should be shared rather than copied per connection, which is what the
+// shared_ptr overload is for.
+template <typename HttpResponse> class ResponseWriter {
+public:
+  static constexpr size_t DefaultChunkSize = 64 * 1024;
+
+  static void send(HttpResponse *res, std::string body,
+                   size_t chunkSize = DefaultChunkSize) {
+    send(res, std::make_shared<const std::string>(std::move(body)), chunkSize);
+  }
+
+  static void send(HttpResponse *res, std::shared_ptr<const std::string> body,
+                   size_t chunkSize = DefaultChunkSize) {
+    size_t pos = 0;
+    start(res, body->size(), [=]() mutable {
+      std::string_view chunk = std::string_view(*body).substr(pos, chunkSize);
+      pos += chunk.size();
+      return chunk;
+    });
+  }
+
+  // Sends exactly size bytes. If the stream turns out to be shorter or longer,
+  // e.g. because the file changed since it was sized, the connection is
+  // closed rather than sending a body that disagrees with Content-Length.
+  static void send(HttpResponse *res, std::shared_ptr<std::istream> in,
+                   uintmax_t size, size_t chunkSize = DefaultChunkSize) {
+    auto buffer = std::make_shared<std::vector<char>>(
+        std::min<uintmax_t>(size, chunkSize));
+    uintmax_t remaining = size;
+    start(res, size, [=]() mutable {
+      in->read(buffer->data(), std::min<uintmax_t>(buffer->size(), remaining));
+      auto read = in->gcount();
+      remaining -= read;
+      if (remaining == 0 && in->peek() != std::char_traits<char>::eof()) {
+        return std::string_view(); // stream is longer than size
+      }
+      return std::string_view(buffer->data(), read);
+    });
+  }
+
+private:
+  struct State {
+    std::function<std::string_view()> next;
+    std::string_view pending;
+    uintmax_t pendingOffset = 0;
+    uintmax_t totalSize;
+  };
+
+  static void start(HttpResponse *res, uintmax_t totalSize,
+                    std::function<std::string_view()> next) {
+    if (totalSize == 0) {
+      res->end();
+      return;
+    }
+
+    auto state = std::make_shared<State>();
+    state->next = std::move(next);
+    state->totalSize = totalSize;
+    if (pump(res, *state)) {
+      return;
+    }
+
+    res->onWritable([=](auto offset) {
+      state->pending = state->pending.substr(offset - state->pendingOffset);
+      state->pendingOffset = offset;
+      return pump(res, *state);
+    });
+    res->onAborted([=]() { SPDLOG_DEBUG("Response aborted while writing"); });
+  }
+
+  // Returns false while the client is applying backpressure. Timed on every
+  // call, since for slow clients most of the work happens from onWritable.
+  static bool pump(HttpResponse *res, State &state) {
+    PROFILE_SCOPE("ResponseWriter::pump");
+    while (true) {
+      if (state.pending.empty()) {
+        {
+          PROFILE_SCOPE("ResponseWriter::pump::next");
+          state.pending = state.next();
+        }
+        state.pendingOffset = res->getWriteOffset();
+        if (state.pending.empty()) {
+          SPDLOG_ERROR("Response body does not match its size of {} bytes",
+                       state.totalSize);
+          res->close();
+          return true;
+        }
+      }
+
+      auto [ok, done] = res->tryEnd(state.pending, state.totalSize);
+      if (done) {
+        return true;
+      }
+      if (!ok) {
+        return false;
+      }
+      state.pending = {};
+    }
+  }
+};
+
 template <typename HttpResponse, typename HttpRequest> class RequestHandler {
 public:
   void handleRequest(HttpResponse *res, HttpRequest *req) {
+    PROFILE_SCOPE("RequestHandler::handleRequest");
     SPDLOG_DEBUG("{} {}", req->getMethod(), req->getUrl());
     doRequest(res, req);
   }
@@ -43,6 +154,7 @@ protected:
     res->onData([=](std::string_view chunk, bool isEnd) {
       buffer->insert(buffer->end(), chunk.begin(), chunk.end());
       if (isEnd) {
+        PROFILE_SCOPE("JsonController::parseJson");
         if (buffer->empty()) {
           res->writeStatus("400 Bad Request")->end("Missing request body");
           return;
@@ -50,8 +162,14 @@ protected:
 
         Json::Value json;
         std::string errs;
-        if (this->reader->parse(&buffer->front(), &buffer->back() + 1,
-                                &json, &errs)) {
+        bool parsed;
+        {
+          PROFILE_SCOPE("JsonController::parseJson::parse");
+          parsed = this->reader->parse(&buffer->front(), &buffer->back() + 1,
+                                       &json, &errs);
+        }
+
+        if (parsed) {
           cb(res, json);
         } else {
           res->writeStatus("400 Bad Request")->end(errs);
@@ -66,22 +184,30 @@ protected:
   }
 
   void end(HttpResponse *res) {
-    res->writeStatus("204 No Content")
-        ->writeHeader("Access-Control-Allow-Origin", "*")
-        ->end();
+    writeHeaders(res->writeStatus("204 No Content"), Headers::Cors)->end();
   }
 
-  void tryEnd(HttpResponse *res, Json::Value &json) {
+  // Returns nullptr for an empty value, which is answered with 204.
+  std::shared_ptr<const std::string> serialize(const Json::Value &json) {
     if (json.empty()) {
-      this->end(res);
-      return;
+      return nullptr;
     }
+    PROFILE_SCOPE("JsonController::serialize");
     std::ostringstream str;
     this->writer->write(json, &str);
+    return std::make_shared<const std::string>(str.str());
+  }
 
-    res->writeHeader("Access-Control-Allow-Origin", "*")
-        ->writeHeader("Content-Type", "application/json")
-        ->end(str.str());
+  // The body is shared with, not copied into, the connection, so one
+  // serialized payload may be sent to any number of clients.
+  void tryEnd(HttpResponse *res, std::shared_ptr<const std::string> body) {
+    if (!body) {
+      this->end(res);
+      return;
+    }
+    PROFILE_SCOPE("JsonController::tryEnd");
+    writeHeaders(res, Headers::Json);
+    ResponseWriter<HttpResponse>::send(res, std::move(body));
   }
 };
 
@@ -90,13 +216,33 @@ class ProductController : public JsonController<HttpResponse, HttpRequest> {
 private:
   Products::ProductManager *pm;
 
+  // Serialized answer to "all" as of allVersion. Slow clients keep a reference
+  // until they have received it, so it is built once per version rather than
+  // once per request. Like the rest of the controller, it belongs to one loop.
+  std::shared_ptr<const std::string> all;
+  std::optional<uint64_t> allVersion;
+
+  std::shared_ptr<const std::string> getAll() {
+    // The version is read first: a write landing in between makes the payload
+    // newer than its version, which only costs one extra rebuild.
+    auto version = this->pm->getVersion();
+    if (version != this->allVersion) {
+      Json::Value json;
+      {
+        PROFILE_SCOPE("ProductController::buildJson");
+        json << this->pm->getAllProducts();
+      }
+      this->all = this->serialize(json);
+      this->allVersion = version;
+    }
+    return this->all;
+  }
+
   virtual void doRequest(HttpResponse *res, HttpRequest *req) override {
-    Json::Value json;
     auto requestType = req->getMethod();
     auto param = req->getParameter(0);
     if (param == "all" && requestType == "get") {
-      json << this->pm->getAllProducts();
-      this->tryEnd(res, json);
+      this->tryEnd(res, this->getAll());
     } else if (param == "create" && requestType == "post") {
       this->parseJson(res, [this](auto *res, auto &json) {
         Products::Product pdt;
@@ -132,63 +278,101 @@ public:
   ProductController(Products::ProductManager *pm) { this->pm = pm; }
 };
 
-static inline bool hasExt(const std::string &file, const std::string &ext) {
-  if (ext.size() > file.size()) {
-    return false;
-  }
+template <typename HttpResponse, typename HttpRequest>
+class FsHandler : public RequestHandler<HttpResponse, HttpRequest> {
+private:
+  const Assets::AssetCache *assets;
 
-  return std::equal(ext.rbegin(), ext.rend(), file.rbegin());
-}
+  virtual void doRequest(HttpResponse *res, HttpRequest *req) override {
+    auto normalized = Assets::normalizePath(req->getUrl());
+    if (!normalized) {
+      res->writeStatus("400 Bad Request")->end("Invalid Path");
+      return;
+    }
+    std::string path = *normalized == "/" ? "/index.html" : *normalized;
 
-template <typename HttpResponse>
-static void addContentType(const std::string &path, HttpResponse *res) {
-  if (hasExt(path, ".html")) {
-    res->writeHeader("Content-Type", "text/html");
-  } else if (hasExt(path, ".css")) {
-    res->writeHeader("Content-Type", "text/css");
-  } else if (hasExt(path, ".js")) {
-    res->writeHeader("Content-Type", "text/javascript");
-  } else if (hasExt(path, ".ico")) {
-    res->writeHeader("Content-Type", "image/x-icon");
+    if (this->assets) {
+      this->sendAsset(res, req, path);
+    } else {
+      this->sendFile(res, path);
+    }
   }
-}
 
-static inline unsigned int getBufSiz(const char *filename) {
-  struct stat buf;
-  if (stat(filename, &buf) == 0) {
-    return buf.st_blksize;
-  }
+  void sendAsset(HttpResponse *res, HttpRequest *req, const std::string &path) {
+    std::shared_ptr<const Assets::Asset> asset;
+    {
+      PROFILE_SCOPE("FsHandler::findAsset");
+      asset = this->assets->find(path);
+    }
+    if (!asset) {
+      res->writeStatus("404 Not Found")->end("Not Found");
+      return;
+    }
 
-  return (unsigned int)BUFSIZ;
-}
+    bool gzip = asset->Gzipped && req->getHeader("accept-encoding").find(
+                                      "gzip") != std::string_view::npos;
+    const auto &etag = gzip ? asset->GzippedETag : asset->ETag;
+    bool notModified = req->getHeader("if-none-match") == etag;
 
-template <typename HttpResponse, typename HttpRequest>
-class FsHandler : public RequestHandler<HttpResponse, HttpRequest> {
-private:
-  std::vector<char> buffer;
+    writeFileHeaders(res->writeStatus(notModified ? "304 Not Modified"
+                                                  : "200 OK"),
+                     path)
+        ->writeHeader("ETag", etag);
+    if (asset->Gzipped) {
+      res->writeHeader("Vary", "Accept-Encoding");
+    }
 
-  virtual void doRequest(HttpResponse *res, HttpRequest *req) override {
-    auto url = req->getUrl();
-    std::string path = url == "/" ? "/index.html" : std::string(url);
+    if (notModified) {
+      res->end();
+    } else if (gzip) {
+      res->writeHeader("Content-Encoding", "gzip");
+      ResponseWriter<HttpResponse>::send(res, asset->Gzipped);
+    } else {
+      ResponseWriter<HttpResponse>::send(res, asset->Content);
+    }
+  }
 
+  void sendFile(HttpResponse *res, const std::string &path) {
     std::string filename = path.substr(1);
-    std::ifstream in(filename);
-    if (!in) {
+    std::shared_ptr<std::ifstream> in;
+    std::error_code ec;
+    uintmax_t size;
+    {
+      PROFILE_SCOPE("FsHandler::openFile");
+      in = std::make_shared<std::ifstream>(filename, std::ios::binary);
+      size = std::filesystem::file_size(filename, ec);
+    }
+    if (!*in || ec) {
       res->writeStatus("404 Not Found")->end("Not Found");
       return;
     }
 
-    res->writeStatus("200 OK");
-    addContentType(path, res);
-    auto bufsiz = getBufSiz(filename.c_str());
-    this->buffer.reserve(bufsiz);
-    while (!in.eof()) {
-      in.read(this->buffer.data(), bufsiz);
-      auto read = in.gcount();
-      std::string_view sv(this->buffer.data(), read);
-      res->write(sv);
+    writeFileHeaders(res->writeStatus("200 OK"), path);
+    ResponseWriter<HttpResponse>::send(res, in, size);
+  }
+
+public:
+  // Serves from the in-memory asset cache if given, otherwise reads files
+  // from the working directory on every request.
+  FsHandler(const Assets::AssetCache *assets = nullptr) {
+    this->assets = assets;
+  }
+};
+
+template <typename HttpResponse, typename HttpRequest>
+class TraceController : public RequestHandler<HttpResponse, HttpRequest> {
+private:
+  virtual void doRequest(HttpResponse *res, HttpRequest *req) override {
+    if (req->getQuery("reset") == "1") {
+      Profiling::reset();
+      res->writeStatus("204 No Content")->end();
+      return;
     }
-    res->end();
+
+    std::ostringstream str;
+    Profiling::dumpChromeTrace(str);
+    writeHeaders(res->writeStatus("200 OK"), Headers::Trace);
+    ResponseWriter<HttpResponse>::send(res, str.str());
   }
 };
 
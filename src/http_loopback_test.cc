@@ -0,0 +1,312 @@
+#include "App.h"
+#include "http.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// These tests run ResponseWriter against the real uWS library over loopback,
+// where MockResponse can only encode assumptions about it.
+
+typedef uWS::HttpResponse<false> Response;
+
+// Runs a uWS app on an ephemeral port, on a thread of its own, until
+// destroyed. Clients must have disconnected by then.
+class LoopbackServer {
+private:
+  std::thread thread;
+  uWS::Loop *loop = nullptr;
+  us_listen_socket_t *listenSocket = nullptr;
+
+public:
+  int port = -1;
+
+  explicit LoopbackServer(std::function<void(uWS::App &)> routes) {
+    std::promise<int> listening;
+    auto port = listening.get_future();
+    this->thread = std::thread([this, routes, &listening]() {
+      this->loop = uWS::Loop::get();
+      uWS::App app;
+      routes(app);
+      app.listen(0, [this, &listening](auto *listenSocket) {
+        this->listenSocket = listenSocket;
+        listening.set_value(
+            listenSocket ? us_socket_local_port(
+                               0, (struct us_socket_t *)listenSocket)
+                         : -1);
+      });
+      if (this->listenSocket) {
+        app.run();
+      }
+    });
+    this->port = port.get();
+  }
+
+  ~LoopbackServer() {
+    if (this->listenSocket) {
+      this->loop->defer(
+          [this]() { us_listen_socket_close(0, this->listenSocket); });
+    }
+    this->thread.join();
+  }
+};
+
+struct ClientResponse {
+  std::string Head; // status line and headers
+  std::string Body;
+  bool Closed = false; // by the server, before the body was complete
+  bool TimedOut = false;
+};
+
+// Blocking HTTP/1.1 client with a small receive buffer that reads 1 KiB at a
+// time, pausing in between, so that the server sees backpressure.
+class SlowClient {
+private:
+  int fd = -1;
+
+public:
+  std::atomic<size_t> received{0}; // body bytes of the current response
+
+  explicit SlowClient(int port) {
+    this->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int rcvbuf = 4096;
+    timeval timeout{5, 0};
+    setsockopt(this->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(this->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(this->fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(this->fd);
+      this->fd = -1;
+    }
+  }
+
+  ~SlowClient() {
+    if (this->fd != -1) {
+      close(this->fd);
+    }
+  }
+
+  bool isConnected() const { return this->fd != -1; }
+
+  // Stops after maxBody bytes of the body, leaving the rest unread.
+  ClientResponse get(const std::string &path, size_t maxBody = SIZE_MAX) {
+    ClientResponse response;
+    std::string request =
+        "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (send(this->fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+        (ssize_t)request.size()) {
+      response.Closed = true;
+      return response;
+    }
+
+    std::string data;
+    size_t headEnd = std::string::npos;
+    size_t length = SIZE_MAX;
+    char buf[1024];
+    this->received = 0;
+    while (headEnd == std::string::npos ||
+           data.size() - headEnd < std::min(length, maxBody)) {
+      ssize_t n = recv(this->fd, buf, sizeof(buf), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        response.TimedOut = true;
+        break;
+      } else if (n <= 0) {
+        response.Closed = true;
+        break;
+      }
+      data.append(buf, n);
+
+      if (headEnd == std::string::npos) {
+        auto end = data.find("\r\n\r\n");
+        if (end == std::string::npos) {
+          continue;
+        }
+        headEnd = end + 4;
+        auto header = data.find("Content-Length: ");
+        if (header < headEnd) {
+          length = std::stoul(data.substr(header + 16));
+        }
+      }
+      this->received = data.size() - headEnd;
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    response.Head = data.substr(0, headEnd);
+    if (headEnd != std::string::npos) {
+      response.Body = data.substr(headEnd);
+    }
+    return response;
+  }
+};
+
+// Body source that reports every read the writer makes, i.e. every chunk it
+// takes on, and when the writer lets go of it.
+class ObservedStream : public std::istream {
+private:
+  class Buffer : public std::stringbuf {
+  public:
+    std::function<void(std::streamsize)> onRead;
+
+    using std::stringbuf::stringbuf;
+
+  protected:
+    std::streamsize xsgetn(char *s, std::streamsize n) override {
+      auto read = std::stringbuf::xsgetn(s, n);
+      this->onRead(read);
+      return read;
+    }
+  };
+
+  Buffer buffer;
+  std::function<void()> onRelease;
+
+public:
+  ObservedStream(const std::string &data,
+                 std::function<void(std::streamsize)> onRead,
+                 std::function<void()> onRelease = [] {})
+      : std::istream(&this->buffer), buffer(data),
+        onRelease(std::move(onRelease)) {
+    this->buffer.onRead = std::move(onRead);
+  }
+
+  ~ObservedStream() { this->onRelease(); }
+};
+
+// Keeps the kernel from absorbing the body, so that backpressure reaches uWS.
+static void shrinkSendBuffer(Response *res) {
+  int fd = (int)(intptr_t)us_socket_get_native_handle(
+      0, (struct us_socket_t *)res);
+  int sndbuf = 4096;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+}
+
+static std::string patterned(size_t size) {
+  std::string data(size, 'x');
+  for (size_t i = 0; i < data.size(); i += 7) {
+    data[i] = 'a' + i % 26;
+  }
+  return data;
+}
+
+TEST(HttpLoopback, ResponseWriterThrottledClient) {
+  const size_t chunkSize = 16 * 1024;
+  // Kernel socket buffers on both ends plus the client's read buffer.
+  const size_t slack = 64 * 1024;
+  std::string content = patterned(1024 * 1024);
+
+  std::atomic<size_t> *received = nullptr;
+  std::atomic<size_t> reads{0}, maxAhead{0}, maxBuffered{0}, misplaced{0};
+  {
+    LoopbackServer server([&](uWS::App &app) {
+      app.get("/file", [&](auto *res, auto *req) {
+        shrinkSendBuffer(res);
+        auto produced = std::make_shared<size_t>(0);
+        auto in = std::make_shared<ObservedStream>(
+            content, [&, res, produced](std::streamsize n) {
+              // The previous chunk must be fully handed to uWS before the
+              // next one is read, and uWS must not be buffering it.
+              misplaced += *produced != res->getWriteOffset();
+              maxBuffered = std::max<size_t>(maxBuffered,
+                                             res->getBufferedAmount());
+              *produced += n;
+              maxAhead = std::max(maxAhead.load(), *produced - *received);
+              reads++;
+            });
+        Http::ResponseWriter<Response>::send(res, in, content.size(),
+                                             chunkSize);
+      });
+    });
+    ASSERT_NE(server.port, -1);
+
+    SlowClient client(server.port);
+    ASSERT_TRUE(client.isConnected());
+    received = &client.received;
+    auto response = client.get("/file");
+    ASSERT_FALSE(response.Closed);
+    ASSERT_FALSE(response.TimedOut);
+    ASSERT_EQ(response.Head.rfind("HTTP/1.1 200 OK", 0), (size_t)0);
+    ASSERT_EQ(response.Body.size(), content.size());
+    ASSERT_TRUE(response.Body == content);
+
+    // The connection stays usable for the next request.
+    response = client.get("/file");
+    ASSERT_FALSE(response.Closed);
+    ASSERT_FALSE(response.TimedOut);
+    ASSERT_TRUE(response.Body == content);
+  }
+
+  ASSERT_EQ(reads.load(), 2 * content.size() / chunkSize);
+  ASSERT_EQ(misplaced.load(), (size_t)0);
+  ASSERT_LE(maxBuffered.load(), chunkSize);
+  ASSERT_LE(maxAhead.load(), chunkSize + slack);
+}
+
+TEST(HttpLoopback, ResponseWriterClientDisconnects) {
+  std::string content = patterned(1024 * 1024);
+  std::atomic<bool> released{false};
+  LoopbackServer server([&](uWS::App &app) {
+    app.get("/file", [&](auto *res, auto *req) {
+      shrinkSendBuffer(res);
+      auto in = std::make_shared<ObservedStream>(
+          content, [](std::streamsize) {}, [&]() { released = true; });
+      Http::ResponseWriter<Response>::send(res, in, content.size(),
+                                           16 * 1024);
+    });
+  });
+  ASSERT_NE(server.port, -1);
+
+  {
+    SlowClient client(server.port);
+    ASSERT_TRUE(client.isConnected());
+    auto response = client.get("/file", 32 * 1024);
+    ASSERT_FALSE(response.Closed);
+    ASSERT_FALSE(response.TimedOut);
+    ASSERT_LT(response.Body.size(), content.size());
+  }
+
+  // uWS reports the abort and drops the writer along with the stream.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!released && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(released);
+
+  SlowClient next(server.port);
+  ASSERT_TRUE(next.isConnected());
+  auto response = next.get("/file");
+  ASSERT_FALSE(response.Closed);
+  ASSERT_FALSE(response.TimedOut);
+  ASSERT_TRUE(response.Body == content);
+}
+
+TEST(HttpLoopback, ResponseWriterSizeMismatch) {
+  LoopbackServer server([&](uWS::App &app) {
+    app.get("/short", [](auto *res, auto *req) {
+      Http::ResponseWriter<Response>::send(
+          res, std::make_shared<std::istringstream>("abcd"), 10);
+    });
+  });
+  ASSERT_NE(server.port, -1);
+
+  SlowClient client(server.port);
+  ASSERT_TRUE(client.isConnected());
+  auto response = client.get("/short");
+  ASSERT_FALSE(response.TimedOut);
+  ASSERT_TRUE(response.Closed);
+
+  // Whatever was flushed before closing is a prefix of the short body.
+  if (!response.Head.empty()) {
+    ASSERT_NE(response.Head.find("Content-Length: 10"), std::string::npos);
+  }
+  ASSERT_EQ(std::string("abcd").rfind(response.Body, 0), (size_t)0);
+}
@@ -13,6 +13,7 @@ public:
   MOCK_METHOD(int, createProduct, (const Products::Product &), (override));
   MOCK_METHOD(bool, updateProduct, (const Products::Product &), (override));
   MOCK_METHOD(void, deleteProduct, (const int &id), (override));
+  MOCK_METHOD(uint64_t, getVersion, (), (const, override));
 };
 
 TEST(Http, FsHandlerFileNotFound) {
@@ -46,9 +47,235 @@ TEST(Http, FsHandlerReadFile) {
   handler.handleRequest(&res, &req);
   ASSERT_EQ(res.getStatus(), "200 OK");
   ASSERT_EQ(res.getHeaderValue("Content-Type"), "text/html");
+  ASSERT_EQ(res.getHeaderValue("Cache-Control"), "no-cache");
   ASSERT_EQ(res.getBody(), "Hello world!");
 }
 
+TEST(Http, FsHandlerRejectsTraversal) {
+  using namespace testing;
+  NiceMock<MockRequest> req;
+  EXPECT_CALL(req, getMethod()).WillRepeatedly(Return("get"));
+  EXPECT_CALL(req, getUrl()).WillRepeatedly(Return("/../../etc/passwd"));
+  MockResponse res;
+
+  Http::FsHandler<MockResponse, MockRequest> handler;
+  handler.handleRequest(&res, &req);
+  ASSERT_EQ(res.getStatus(), "400 Bad Request");
+}
+
+TEST(Http, FsHandlerAssetCache) {
+  using namespace testing;
+  CustomTmpDir dir;
+  ASSERT_TRUE(dir.isOpen());
+  std::string html(4096, 'a');
+  dir.write("index.html", html);
+  Assets::AssetCache assets(dir.path);
+  auto etag = assets.find("/index.html")->ETag;
+  auto gzipEtag = assets.find("/index.html")->GzippedETag;
+  Http::FsHandler<MockResponse, MockRequest> handler(&assets);
+
+  NiceMock<MockRequest> req;
+  EXPECT_CALL(req, getMethod()).WillRepeatedly(Return("get"));
+  EXPECT_CALL(req, getUrl()).WillRepeatedly(Return("/"));
+  EXPECT_CALL(req, getHeader(_)).WillRepeatedly(Return(""));
+
+  MockResponse plain;
+  handler.handleRequest(&plain, &req);
+  ASSERT_EQ(plain.getStatus(), "200 OK");
+  ASSERT_EQ(plain.getHeaderValue("Content-Type"), "text/html");
+  ASSERT_EQ(plain.getHeaderValue("ETag"), etag);
+  ASSERT_EQ(plain.getHeaderValue("Content-Encoding"), "");
+  ASSERT_EQ(plain.getBody(), html);
+
+  EXPECT_CALL(req, getHeader(std::string_view("accept-encoding")))
+      .WillRepeatedly(Return("gzip, deflate, br"));
+  MockResponse gzipped;
+  handler.handleRequest(&gzipped, &req);
+  ASSERT_EQ(gzipped.getStatus(), "200 OK");
+  ASSERT_EQ(gzipped.getHeaderValue("Content-Encoding"), "gzip");
+  ASSERT_EQ(gzipped.getHeaderValue("Vary"), "Accept-Encoding");
+  ASSERT_LT(gzipped.getBody().size(), html.size());
+
+  ASSERT_EQ(gzipped.getHeaderValue("ETag"), gzipEtag);
+
+  // Each encoding is only revalidated by its own tag.
+  EXPECT_CALL(req, getHeader(std::string_view("if-none-match")))
+      .WillRepeatedly(Return(etag));
+  MockResponse mismatched;
+  handler.handleRequest(&mismatched, &req);
+  ASSERT_EQ(mismatched.getStatus(), "200 OK");
+
+  EXPECT_CALL(req, getHeader(std::string_view("if-none-match")))
+      .WillRepeatedly(Return(gzipEtag));
+  MockResponse cached;
+  handler.handleRequest(&cached, &req);
+  ASSERT_EQ(cached.getStatus(), "304 Not Modified");
+  ASSERT_EQ(cached.getHeaderValue("ETag"), gzipEtag);
+  ASSERT_EQ(cached.getHeaderValue("Vary"), "Accept-Encoding");
+  ASSERT_TRUE(cached.getBody().empty());
+
+  EXPECT_CALL(req, getHeader(std::string_view("accept-encoding")))
+      .WillRepeatedly(Return(""));
+  MockResponse identity;
+  handler.handleRequest(&identity, &req);
+  ASSERT_EQ(identity.getStatus(), "200 OK");
+  ASSERT_EQ(identity.getHeaderValue("Content-Encoding"), "");
+  ASSERT_EQ(identity.getBody(), html);
+
+  EXPECT_CALL(req, getUrl()).WillRepeatedly(Return("/missing.js"));
+  MockResponse missing;
+  handler.handleRequest(&missing, &req);
+  ASSERT_EQ(missing.getStatus(), "404 Not Found");
+}
+
+TEST(Http, MimeTypes) {
+  ASSERT_EQ(Http::mimeType("/manifest.json"), "application/json");
+  ASSERT_EQ(Http::mimeType("/static/js/main.1a2b3c4d.chunk.js.map"),
+            "application/json");
+  ASSERT_EQ(Http::mimeType("/static/media/font.0123abcd.woff2"), "font/woff2");
+  ASSERT_EQ(Http::mimeType("/logo192.png"), "image/png");
+  ASSERT_EQ(Http::mimeType("/favicon.ico"), "image/x-icon");
+  ASSERT_TRUE(Http::mimeType("/LICENSE").empty());
+  ASSERT_TRUE(Http::mimeType("/archive.unknown").empty());
+}
+
+TEST(Http, HashedAssets) {
+  ASSERT_TRUE(Http::isHashedAsset("/static/js/main.1a2b3c4d.chunk.js"));
+  ASSERT_TRUE(Http::isHashedAsset("/static/js/2.0123abcd.chunk.js.map"));
+  ASSERT_TRUE(Http::isHashedAsset("/static/css/main.deadbeef.css"));
+  ASSERT_FALSE(Http::isHashedAsset("/static/js/runtime-main.js"));
+  ASSERT_FALSE(Http::isHashedAsset("/static/js/main.chunk.js"));
+  ASSERT_FALSE(Http::isHashedAsset("/deadbeef.js"));
+  ASSERT_FALSE(Http::isHashedAsset("/a1b2c3d4.x/index.html"));
+
+  // Only react-scripts build output is known to be named by its content.
+  ASSERT_FALSE(Http::isHashedAsset("/report.20240101.pdf"));
+  ASSERT_FALSE(Http::isHashedAsset("/static/data.deadbeef.json"));
+  ASSERT_FALSE(Http::isHashedAsset("/static/docs/guide.0123abcd.pdf"));
+  ASSERT_FALSE(Http::isHashedAsset("/files/static/js/main.1a2b3c4d.js"));
+
+  MockResponse res;
+  Http::writeFileHeaders(&res, "/static/css/main.deadbeef.css");
+  ASSERT_EQ(res.getHeaderValue("Content-Type"), "text/css");
+  ASSERT_EQ(res.getHeaderValue("Cache-Control"),
+            "public, max-age=31536000, immutable");
+
+  MockResponse data;
+  Http::writeFileHeaders(&data, "/export.20240101.json");
+  ASSERT_EQ(data.getHeaderValue("Content-Type"), "application/json");
+  ASSERT_EQ(data.getHeaderValue("Cache-Control"), "no-cache");
+}
+
+TEST(Http, FsHandlerThrottledClient) {
+  using namespace testing;
+  CustomTmpFile tmpf(".js");
+  ASSERT_TRUE(tmpf.isOpen());
+
+  std::string content(300 * 1024, 'x');
+  for (size_t i = 0; i < content.size(); i += 7) {
+    content[i] = 'a' + i % 26;
+  }
+  tmpf.write(content);
+  std::filesystem::path tmpPath(tmpf.filename);
+
+  NiceMock<MockRequest> req;
+  EXPECT_CALL(req, getMethod()).WillRepeatedly(Return("get"));
+  EXPECT_CALL(req, getUrl())
+      .WillRepeatedly(Return("/" + tmpPath.filename().string()));
+
+  MockResponse res;
+  res.writeLimit = 10000;
+  Http::FsHandler<MockResponse, MockRequest> handler;
+  handler.handleRequest(&res, &req);
+  ASSERT_FALSE(res.isEnded());
+
+  int drains = 0;
+  while (res.drain()) {
+    drains++;
+  }
+
+  ASSERT_TRUE(res.isEnded());
+  ASSERT_GT(drains, 1);
+  ASSERT_EQ(res.getStatus(), "200 OK");
+  ASSERT_EQ(res.getBody(), content);
+  ASSERT_LE(res.getLargestWrite(),
+            Http::ResponseWriter<MockResponse>::DefaultChunkSize);
+}
+
+TEST(Http, ResponseWriterManySlowClients) {
+  auto body = std::make_shared<const std::string>(64 * 1024, 'y');
+  const size_t chunkSize = 4096;
+  std::vector<MockResponse> clients(1000);
+  for (auto &res : clients) {
+    res.writeLimit = 1500;
+    Http::ResponseWriter<MockResponse>::send(&res, body, chunkSize);
+  }
+
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (auto &res : clients) {
+      pending |= res.drain();
+    }
+  }
+
+  for (const auto &res : clients) {
+    ASSERT_TRUE(res.isEnded());
+    ASSERT_EQ(res.getBody(), *body);
+    ASSERT_LE(res.getLargestWrite(), chunkSize);
+  }
+}
+
+#ifdef CPPHTTP_PROFILING
+TEST(Http, ResponseWriterProfilesEveryPump) {
+  Profiling::reset();
+  MockResponse res;
+  res.writeLimit = 100;
+  Http::ResponseWriter<MockResponse>::send(&res, std::string(1000, 'p'), 300);
+  int drains = 0;
+  while (res.drain()) {
+    drains++;
+  }
+
+  int pumps = 0, reads = 0;
+  for (const auto &event : Profiling::threadBuffer().snapshot()) {
+    pumps += std::string_view(event.Name) == "ResponseWriter::pump";
+    reads += std::string_view(event.Name) == "ResponseWriter::pump::next";
+  }
+  ASSERT_TRUE(res.isEnded());
+  ASSERT_EQ(pumps, drains + 1);
+  ASSERT_EQ(reads, 4);
+}
+#endif
+
+TEST(Http, ResponseWriterAborted) {
+  MockResponse res;
+  res.writeLimit = 100;
+  Http::ResponseWriter<MockResponse>::send(&res, std::string(1000, 'z'), 300);
+  ASSERT_TRUE(res.drain());
+
+  res.abort();
+  ASSERT_FALSE(res.drain());
+  ASSERT_FALSE(res.isEnded());
+  ASSERT_EQ(res.getBody().size(), (size_t)200);
+}
+
+TEST(Http, ResponseWriterSizeMismatch) {
+  MockResponse longer;
+  Http::ResponseWriter<MockResponse>::send(
+      &longer, std::make_shared<std::istringstream>("abcdefgh"), 4);
+  ASSERT_TRUE(longer.isClosed());
+  ASSERT_FALSE(longer.isEnded());
+  ASSERT_TRUE(longer.getBody().empty());
+
+  MockResponse shorter;
+  Http::ResponseWriter<MockResponse>::send(
+      &shorter, std::make_shared<std::istringstream>("abcd"), 10);
+  ASSERT_TRUE(shorter.isClosed());
+  ASSERT_FALSE(shorter.isEnded());
+  ASSERT_EQ(shorter.getBody(), "abcd");
+}
+
 TEST(Http, ProductCtrlGetAll) {
   using namespace testing;
   std::vector<Products::Product> pdts{Products::Product{1, "Volvo", "SUV"}};
@@ -65,9 +292,70 @@ TEST(Http, ProductCtrlGetAll) {
   pdtctrl.handleRequest(&res, &req);
 
   ASSERT_EQ(res.getHeaderValue("Content-Type"), "application/json");
+  ASSERT_EQ(res.getHeaderValue("Access-Control-Allow-Origin"), "*");
   ASSERT_FALSE(res.getBody().empty());
 }
 
+TEST(Http, ProductCtrlManySlowClients) {
+  using namespace testing;
+  std::vector<Products::Product> pdts;
+  for (int i = 0; i < 1000; i++) {
+    pdts.push_back(Products::Product{i, "Volvo", std::string(100, 'd')});
+  }
+  NiceMock<MockProductManager> pm;
+  EXPECT_CALL(pm, getVersion()).WillRepeatedly(Return(1));
+  EXPECT_CALL(pm, getAllProducts()).Times(1).WillOnce(Return(pdts));
+
+  NiceMock<MockRequest> req;
+  EXPECT_CALL(req, getUrl()).WillRepeatedly(Return("/api/v1/products/all"));
+  EXPECT_CALL(req, getParameter(0)).WillRepeatedly(Return("all"));
+  EXPECT_CALL(req, getMethod()).WillRepeatedly(Return("get"));
+
+  // Every client makes its own request, yet the payload is built once and
+  // shared by all of them.
+  Http::ProductController<MockResponse, MockRequest> pdtctrl(&pm);
+  std::vector<MockResponse> clients(100);
+  for (auto &res : clients) {
+    res.writeLimit = 1500;
+    pdtctrl.handleRequest(&res, &req);
+  }
+
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (auto &res : clients) {
+      pending |= res.drain();
+    }
+  }
+
+  auto expected = clients.front().getBody();
+  ASSERT_GT(expected.size(),
+            Http::ResponseWriter<MockResponse>::DefaultChunkSize);
+  for (const auto &res : clients) {
+    ASSERT_TRUE(res.isEnded());
+    ASSERT_EQ(res.getBody(), expected);
+  }
+
+  // A change to the products is picked up by the next request.
+  EXPECT_CALL(pm, getVersion()).WillRepeatedly(Return(2));
+  EXPECT_CALL(pm, getAllProducts())
+      .Times(1)
+      .WillOnce(Return(std::vector<Products::Product>{pdts.front()}));
+  MockResponse changed;
+  pdtctrl.handleRequest(&changed, &req);
+  ASSERT_TRUE(changed.isEnded());
+  ASSERT_LT(changed.getBody().size(), expected.size());
+
+  // An empty list is answered without a body.
+  EXPECT_CALL(pm, getVersion()).WillRepeatedly(Return(3));
+  EXPECT_CALL(pm, getAllProducts())
+      .Times(1)
+      .WillOnce(Return(std::vector<Products::Product>{}));
+  MockResponse empty;
+  pdtctrl.handleRequest(&empty, &req);
+  ASSERT_EQ(empty.getStatus(), "204 No Content");
+}
+
 TEST(Http, ProductCtrlCreatePdt) {
   using namespace testing;
   NiceMock<MockProductManager> pm;
@@ -175,3 +463,21 @@ TEST(Http, ProductCtrlUnknownRequest) {
 
   ASSERT_EQ(res.getStatus(), "404 Not Found");
 }
+
+TEST(Http, TraceCtrlDump) {
+  using namespace testing;
+  Profiling::reset();
+  Profiling::threadBuffer().record("Http::TraceCtrlDump", 0, 1);
+
+  NiceMock<MockRequest> req;
+  EXPECT_CALL(req, getUrl()).WillRepeatedly(Return("/admin/trace"));
+  EXPECT_CALL(req, getMethod()).WillRepeatedly(Return("get"));
+
+  MockResponse res;
+  Http::TraceController<MockResponse, MockRequest> tracectrl;
+  tracectrl.handleRequest(&res, &req);
+
+  ASSERT_EQ(res.getStatus(), "200 OK");
+  ASSERT_EQ(res.getHeaderValue("Content-Type"), "application/json");
+  ASSERT_NE(res.getBody().find("Http::TraceCtrlDump"), std::string::npos);
+}
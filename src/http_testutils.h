@@ -14,6 +14,7 @@ public:
   MOCK_METHOD(std::string_view, getParameter, (unsigned int));
   MOCK_METHOD(std::string_view, getQuery, ());
   MOCK_METHOD(std::string_view, getQuery, (std::string_view));
+  MOCK_METHOD(std::string_view, getHeader, (std::string_view));
 };
 
 class MockResponse {
@@ -22,10 +23,20 @@ private:
   std::unordered_map<std::string, std::string> header;
   std::ostringstream body;
   bool ended = false;
+  bool closed = false;
+
+  uintmax_t offset = 0;
+  size_t available = SIZE_MAX;
+  size_t largestWrite = 0;
+  std::function<bool(uintmax_t)> writableHandler;
+  std::function<void()> abortedHandler;
 
 public:
   std::vector<std::string> postData; // chunks
 
+  // Bytes accepted per writable event, simulating a slow client.
+  size_t writeLimit = SIZE_MAX;
+
   MockResponse *writeHeader(std::string_view key, std::string_view value) {
     assert(!ended);
     header[std::string(key)] = std::string(value);
@@ -57,7 +68,15 @@ public:
     return;
   }
 
-  void onAborted(std::function<void()> cb) {}
+  MockResponse *onAborted(std::function<void()> cb) {
+    this->abortedHandler = cb;
+    return this;
+  }
+
+  MockResponse *onWritable(std::function<bool(uintmax_t)> cb) {
+    this->writableHandler = cb;
+    return this;
+  }
 
   void end(std::string_view data = {}) {
     assert(!ended);
@@ -65,6 +84,50 @@ public:
     this->ended = true;
   }
 
+  std::pair<bool, bool> tryEnd(std::string_view data, uintmax_t totalSize) {
+    assert(!ended);
+    this->largestWrite = std::max(this->largestWrite, data.size());
+    if (this->available == SIZE_MAX) {
+      this->available = this->writeLimit;
+    }
+
+    auto written = std::min(data.size(), this->available);
+    this->body << data.substr(0, written);
+    this->offset += written;
+    this->available -= written;
+    this->ended = this->offset == totalSize;
+    return {written == data.size(), this->ended};
+  }
+
+  uintmax_t getWriteOffset() const { return this->offset; }
+
+  void close() { this->closed = true; }
+
+  // Lets the client accept another writeLimit bytes. Returns false once there
+  // is nothing left to drain.
+  bool drain() {
+    if (this->ended || this->closed || !this->writableHandler) {
+      return false;
+    }
+
+    this->available = this->writeLimit;
+    this->writableHandler(this->offset);
+    return true;
+  }
+
+  void abort() {
+    if (this->abortedHandler) {
+      this->abortedHandler();
+    }
+    this->closed = true;
+  }
+
+  bool isEnded() const { return this->ended; }
+
+  bool isClosed() const { return this->closed; }
+
+  size_t getLargestWrite() const { return this->largestWrite; }
+
   std::string getStatus() const { return this->status; }
 
   std::string getHeaderValue(const std::string &key) const {
@@ -104,3 +167,35 @@ public:
     delete[] this->filename;
   }
 };
+
+class CustomTmpDir {
+public:
+  std::filesystem::path path;
+
+  CustomTmpDir() {
+    char tpl[] = "/tmp/cpphttp-XXXXXX";
+    if (mkdtemp(tpl)) {
+      this->path = tpl;
+    }
+  }
+
+  bool isOpen() { return !this->path.empty(); }
+
+  void write(const std::string &file, const std::string &data) {
+    auto target = this->path / file;
+    std::filesystem::create_directories(target.parent_path());
+    // Write to a temporary name first, the way deploy tools replace files.
+    auto tmp = this->path / ".tmp";
+    std::ofstream ofs(tmp, std::ios::binary);
+    ofs << data;
+    ofs.close();
+    std::filesystem::rename(tmp, target);
+  }
+
+  ~CustomTmpDir() {
+    if (!this->path.empty()) {
+      std::error_code ec;
+      std::filesystem::remove_all(this->path, ec);
+    }
+  }
+};
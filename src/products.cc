@@ -1,8 +1,18 @@
 #include "products.h"
+#include "profiling.h"
 #include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cassert>
 
 namespace Products {
 
+// Acquires a lock on the store mutex, timing any wait for it separately from
+// the operation itself.
+template <typename Lock> static Lock acquire(std::shared_mutex &mutex) {
+  PROFILE_SCOPE("ProductManagerImpl::lock");
+  return Lock(mutex);
+}
+
 std::ostream &operator<<(std::ostream &os, const Product &p) {
   return os << "Product [Id=" << p.Id << ", Name='" << p.Name
             << "', Description='" << p.Description << "']";
@@ -41,7 +51,8 @@ bool Product::operator==(const Product &p) const {
 bool Product::operator!=(const Product &p) const { return !(*this == p); }
 
 std::vector<Product> ProductManagerImpl::getAllProducts() const {
-  std::shared_lock lock(this->mutex);
+  PROFILE_SCOPE("ProductManagerImpl::getAllProducts");
+  auto lock = acquire<std::shared_lock<std::shared_mutex>>(this->mutex);
   std::vector<Product> products(this->cache.size());
   int i = 0;
   for (const auto &p : this->cache) {
@@ -52,28 +63,33 @@ std::vector<Product> ProductManagerImpl::getAllProducts() const {
 }
 
 std::optional<Product> ProductManagerImpl::getById(const int &id) const {
-  std::shared_lock lock(this->mutex);
+  PROFILE_SCOPE("ProductManagerImpl::getById");
+  auto lock = acquire<std::shared_lock<std::shared_mutex>>(this->mutex);
   const auto &entry = this->cache.find(id);
   return entry != this->cache.end() ? std::optional(entry->second)
                                     : std::nullopt;
 }
 
 int ProductManagerImpl::createProduct(const Product &pdt) {
-  std::unique_lock lock(this->mutex);
+  PROFILE_SCOPE("ProductManagerImpl::createProduct");
+  auto lock = acquire<std::unique_lock<std::shared_mutex>>(this->mutex);
   int nextId = ++this->nextId;
   auto cpy = pdt;
   cpy.Id = nextId;
   this->cache[nextId] = cpy;
+  this->version++;
   SPDLOG_INFO("Created product: {}", cpy);
   return nextId;
 }
 
 bool ProductManagerImpl::updateProduct(const Product &pdt) {
-  std::unique_lock lock(this->mutex);
+  PROFILE_SCOPE("ProductManagerImpl::updateProduct");
+  auto lock = acquire<std::unique_lock<std::shared_mutex>>(this->mutex);
   const auto &entry = this->cache.find(pdt.Id);
   if (entry != this->cache.end()) {
     auto orig = entry->second;
     this->cache[pdt.Id] = pdt;
+    this->version++;
     SPDLOG_INFO("Updated product: {}->{}", orig, pdt);
     return true;
   } else {
@@ -83,11 +99,169 @@ bool ProductManagerImpl::updateProduct(const Product &pdt) {
 }
 
 void ProductManagerImpl::deleteProduct(const int &id) {
-  std::unique_lock lock(this->mutex);
+  PROFILE_SCOPE("ProductManagerImpl::deleteProduct");
+  auto lock = acquire<std::unique_lock<std::shared_mutex>>(this->mutex);
   auto nh = this->cache.extract(id);
   if (nh) {
+    this->version++;
     SPDLOG_INFO("Removed product: {}", nh.mapped());
   }
 }
 
+uint64_t ProductManagerImpl::getVersion() const { return this->version; }
+
+void ReplicatedProductStore::broadcast(ChangeRecord::Op type,
+                                       const Product &pdt) {
+  auto record = std::make_shared<const ChangeRecord>(
+      ChangeRecord{++this->seq, type, pdt});
+  this->log.push_back(record);
+  for (const auto &replica : this->replicas) {
+    auto *r = replica.get();
+    r->executor([r, record]() { r->apply(*record); });
+  }
+
+  // Every replica has already applied these, so none will ask for them.
+  uint64_t applied = this->seq;
+  for (const auto &replica : this->replicas) {
+    applied = std::min(applied, replica->getAppliedSeq());
+  }
+  while (!this->log.empty() && this->log.front()->Seq <= applied) {
+    this->log.pop_front();
+  }
+}
+
+ProductReplica *ReplicatedProductStore::createReplica(Executor executor) {
+  std::lock_guard lock(this->mutex);
+  auto replica = std::unique_ptr<ProductReplica>(
+      new ProductReplica(this, std::move(executor)));
+  for (const auto &p : this->primary.getAllProducts()) {
+    replica->cache[p.Id] = p;
+  }
+  replica->appliedSeq = this->seq;
+  this->replicas.push_back(std::move(replica));
+  return this->replicas.back().get();
+}
+
+int ReplicatedProductStore::createProduct(const Product &pdt, uint64_t *seq) {
+  PROFILE_SCOPE("ReplicatedProductStore::createProduct");
+  std::lock_guard lock(this->mutex);
+  auto cpy = pdt;
+  cpy.Id = this->primary.createProduct(pdt);
+  this->broadcast(ChangeRecord::Op::Upsert, cpy);
+  if (seq) {
+    *seq = this->seq;
+  }
+  return cpy.Id;
+}
+
+bool ReplicatedProductStore::updateProduct(const Product &pdt, uint64_t *seq) {
+  PROFILE_SCOPE("ReplicatedProductStore::updateProduct");
+  std::lock_guard lock(this->mutex);
+  bool updated = this->primary.updateProduct(pdt);
+  if (updated) {
+    this->broadcast(ChangeRecord::Op::Upsert, pdt);
+  }
+  if (seq) {
+    *seq = this->seq;
+  }
+  return updated;
+}
+
+void ReplicatedProductStore::deleteProduct(const int &id, uint64_t *seq) {
+  PROFILE_SCOPE("ReplicatedProductStore::deleteProduct");
+  std::lock_guard lock(this->mutex);
+  if (this->primary.getById(id)) {
+    this->primary.deleteProduct(id);
+    this->broadcast(ChangeRecord::Op::Remove, Product{id, "", ""});
+  }
+  if (seq) {
+    *seq = this->seq;
+  }
+}
+
+std::vector<std::shared_ptr<const ChangeRecord>>
+ReplicatedProductStore::changes(uint64_t from, uint64_t to) {
+  std::lock_guard lock(this->mutex);
+  std::vector<std::shared_ptr<const ChangeRecord>> records;
+  for (const auto &record : this->log) {
+    if (record->Seq > from && record->Seq <= to) {
+      records.push_back(record);
+    }
+  }
+  return records;
+}
+
+uint64_t ReplicatedProductStore::getSeq() {
+  std::lock_guard lock(this->mutex);
+  return this->seq;
+}
+
+ProductReplica::ProductReplica(ReplicatedProductStore *store,
+                               Executor executor)
+    : store(store), executor(std::move(executor)) {}
+
+void ProductReplica::apply(const ChangeRecord &record) {
+  PROFILE_SCOPE("ProductReplica::apply");
+  if (record.Seq <= this->appliedSeq) {
+    return; // already applied while catching up
+  }
+
+  assert(record.Seq == this->appliedSeq + 1);
+  if (record.Type == ChangeRecord::Op::Upsert) {
+    this->cache[record.Pdt.Id] = record.Pdt;
+  } else {
+    this->cache.erase(record.Pdt.Id);
+  }
+  this->appliedSeq = record.Seq;
+}
+
+// Applies every change up to seq now rather than waiting for the executor, so
+// that the caller reads its own write.
+void ProductReplica::catchUp(uint64_t seq) {
+  if (seq <= this->appliedSeq) {
+    return;
+  }
+
+  PROFILE_SCOPE("ProductReplica::catchUp");
+  for (const auto &record : this->store->changes(this->appliedSeq, seq)) {
+    this->apply(*record);
+  }
+}
+
+std::vector<Product> ProductReplica::getAllProducts() const {
+  PROFILE_SCOPE("ProductReplica::getAllProducts");
+  std::vector<Product> products;
+  products.reserve(this->cache.size());
+  for (const auto &p : this->cache) {
+    products.push_back(p.second);
+  }
+  return products;
+}
+
+std::optional<Product> ProductReplica::getById(const int &id) const {
+  const auto &entry = this->cache.find(id);
+  return entry != this->cache.end() ? std::optional(entry->second)
+                                    : std::nullopt;
+}
+
+int ProductReplica::createProduct(const Product &pdt) {
+  uint64_t seq;
+  int id = this->store->createProduct(pdt, &seq);
+  this->catchUp(seq);
+  return id;
+}
+
+bool ProductReplica::updateProduct(const Product &pdt) {
+  uint64_t seq;
+  bool updated = this->store->updateProduct(pdt, &seq);
+  this->catchUp(seq);
+  return updated;
+}
+
+void ProductReplica::deleteProduct(const int &id) {
+  uint64_t seq;
+  this->store->deleteProduct(id, &seq);
+  this->catchUp(seq);
+}
+
 } // namespace Products
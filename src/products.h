@@ -2,8 +2,15 @@
 
 #include "spdlog/fmt/ostr.h"
 #include "json/json.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 namespace Products {
 
@@ -30,6 +37,10 @@ public:
   virtual int createProduct(const Product &) = 0;
   virtual bool updateProduct(const Product &) = 0;
   virtual void deleteProduct(const int &id) = 0;
+
+  // Increases with every change, so that anything derived from the products
+  // can be cached until the version moves on.
+  virtual uint64_t getVersion() const = 0;
 };
 
 class ProductManagerImpl : public ProductManager {
@@ -37,6 +48,81 @@ private:
   mutable std::shared_mutex mutex;
   std::unordered_map<int, Product> cache;
   int nextId = 0;
+  std::atomic<uint64_t> version{0}; // only stored with the mutex held
+
+public:
+  virtual std::vector<Product> getAllProducts() const override;
+  virtual std::optional<Product> getById(const int &id) const override;
+
+  virtual int createProduct(const Product &) override;
+  virtual bool updateProduct(const Product &) override;
+  virtual void deleteProduct(const int &id) override;
+
+  virtual uint64_t getVersion() const override;
+};
+
+struct ChangeRecord {
+  enum class Op { Upsert, Remove };
+
+  uint64_t Seq;
+  Op Type;
+  Product Pdt; // only Id is set for Remove
+};
+
+// Runs a task on the thread owning a replica, e.g. through uWS::Loop::defer.
+// Tasks must run in the order they were submitted.
+typedef std::function<void(std::function<void()>)> Executor;
+
+class ProductReplica;
+
+// Serializes writes against an authoritative store and broadcasts the
+// resulting changes, in order, to every replica. Changes not yet applied by
+// every replica are also kept in a log, which a replica reads from to catch up
+// on its own writes.
+class ReplicatedProductStore {
+private:
+  std::mutex mutex;
+  ProductManagerImpl primary;
+  uint64_t seq = 0;
+  std::deque<std::shared_ptr<const ChangeRecord>> log;
+  std::vector<std::unique_ptr<ProductReplica>> replicas;
+
+  void broadcast(ChangeRecord::Op type, const Product &pdt);
+
+public:
+  // Creates a replica seeded with the current products. Must be called on
+  // the thread that executor runs tasks on, before the replica is used.
+  ProductReplica *createReplica(Executor executor);
+
+  // Each write sets seq, if given, to the sequence number of the last change
+  // it depends on.
+  int createProduct(const Product &, uint64_t *seq = nullptr);
+  bool updateProduct(const Product &, uint64_t *seq = nullptr);
+  void deleteProduct(const int &id, uint64_t *seq = nullptr);
+
+  // Returns the changes with sequence numbers in (from, to].
+  std::vector<std::shared_ptr<const ChangeRecord>> changes(uint64_t from,
+                                                           uint64_t to);
+
+  uint64_t getSeq();
+};
+
+// Thread-local copy of a ReplicatedProductStore. Reads are served without
+// locking and must only happen on the replica's own thread. A write is
+// visible to the replica that made it as soon as it returns; other replicas
+// see it once their executor has run the broadcast change.
+class ProductReplica : public ProductManager {
+private:
+  ReplicatedProductStore *store;
+  Executor executor;
+  std::unordered_map<int, Product> cache;
+  std::atomic<uint64_t> appliedSeq{0}; // only stored by the owning thread
+
+  ProductReplica(ReplicatedProductStore *store, Executor executor);
+  void apply(const ChangeRecord &record);
+  void catchUp(uint64_t seq);
+
+  friend class ReplicatedProductStore;
 
 public:
   virtual std::vector<Product> getAllProducts() const override;
@@ -45,6 +131,10 @@ public:
   virtual int createProduct(const Product &) override;
   virtual bool updateProduct(const Product &) override;
   virtual void deleteProduct(const int &id) override;
+
+  virtual uint64_t getVersion() const override { return this->appliedSeq; }
+
+  uint64_t getAppliedSeq() const { return this->appliedSeq; }
 };
 
 } // namespace Products
@@ -0,0 +1,95 @@
+#include "products.h"
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+// Compares read throughput of the shared, mutex-guarded product store with
+// per-thread replicas as the number of reader threads grows.
+
+#define NUM_PRODUCTS 1000
+#define READS_PER_THREAD 2000000
+#define SCANS_PER_THREAD 2000
+
+using namespace Products;
+
+// Each reader performs opsPerThread calls of op; returns total ops/s.
+static double
+runReaders(unsigned int numThreads,
+           std::function<ProductManager *()> managerForThread,
+           std::function<size_t(ProductManager *, unsigned int, int)> op,
+           int opsPerThread) {
+  std::atomic<unsigned int> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<size_t> found{0};
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t]() {
+      auto *pm = managerForThread();
+      ready++;
+      while (!go) {
+      }
+
+      size_t hits = 0;
+      for (int i = 0; i < opsPerThread; i++) {
+        hits += op(pm, t, i);
+      }
+      found += hits;
+    });
+  }
+
+  while (ready < numThreads) {
+  }
+  auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (auto &t : threads) {
+    t.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (found == 0) {
+    std::printf("no products found\n");
+  }
+  return numThreads * (double)opsPerThread / elapsed.count();
+}
+
+static size_t pointRead(ProductManager *pm, unsigned int t, int i) {
+  return (bool)pm->getById(1 + (i * 7 + t) % NUM_PRODUCTS);
+}
+
+static size_t scan(ProductManager *pm, unsigned int, int) {
+  return pm->getAllProducts().size();
+}
+
+int main() {
+  spdlog::set_level(spdlog::level::warn);
+
+  ProductManagerImpl shared;
+  ReplicatedProductStore store;
+  for (int i = 0; i < NUM_PRODUCTS; i++) {
+    Product pdt{0, "Product " + std::to_string(i), "Description"};
+    shared.createProduct(pdt);
+    store.createProduct(pdt);
+  }
+
+  // No writes happen during the run, so replica tasks never need to execute.
+  Executor noop = [](std::function<void()>) {};
+  auto sharedStore = [&]() -> ProductManager * { return &shared; };
+  auto replica = [&]() -> ProductManager * {
+    return store.createReplica(noop);
+  };
+
+  std::printf("%8s %16s %16s %16s %16s\n", "threads", "shared get/s",
+              "replica get/s", "shared scans/s", "replica scans/s");
+  unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int n = 1; n <= maxThreads; n *= 2) {
+    std::printf("%8u %16.0f %16.0f %16.0f %16.0f\n", n,
+                runReaders(n, sharedStore, pointRead, READS_PER_THREAD),
+                runReaders(n, replica, pointRead, READS_PER_THREAD),
+                runReaders(n, sharedStore, scan, SCANS_PER_THREAD),
+                runReaders(n, replica, scan, SCANS_PER_THREAD));
+  }
+}
@@ -1,5 +1,8 @@
 #include "products.h"
+#include <algorithm>
+#include <deque>
 #include <gtest/gtest.h>
+#include <thread>
 
 namespace Products {
 
@@ -107,4 +110,173 @@ TEST(Products, DeleteProduct) {
   ASSERT_EQ(pm.getAllProducts().size(), (size_t)1);
 }
 
+TEST(Products, VersionFollowsChanges) {
+  ProductManagerImpl pm;
+  ASSERT_EQ(pm.getVersion(), (uint64_t)0);
+  int id = pm.createProduct(Product{0, "Volvo", "SUV"});
+  ASSERT_EQ(pm.getVersion(), (uint64_t)1);
+  pm.updateProduct(Product{id, "Volvo", "Truck"});
+  ASSERT_EQ(pm.getVersion(), (uint64_t)2);
+
+  // Writes that change nothing keep the version.
+  pm.updateProduct(Product{999, "abc", "def"});
+  pm.deleteProduct(999);
+  ASSERT_EQ(pm.getVersion(), (uint64_t)2);
+  pm.deleteProduct(id);
+  ASSERT_EQ(pm.getVersion(), (uint64_t)3);
+}
+
+// Stands in for a uWS loop: deferred tasks queue up until the owning thread
+// drains them.
+class TaskQueue {
+private:
+  std::mutex mutex;
+  std::deque<std::function<void()>> tasks;
+
+public:
+  Executor executor() {
+    return [this](std::function<void()> task) {
+      std::lock_guard lock(this->mutex);
+      this->tasks.push_back(std::move(task));
+    };
+  }
+
+  void drain() {
+    std::deque<std::function<void()>> pending;
+    {
+      std::lock_guard lock(this->mutex);
+      pending.swap(this->tasks);
+    }
+    for (auto &task : pending) {
+      task();
+    }
+  }
+};
+
+static std::vector<Product> sorted(std::vector<Product> pdts) {
+  std::sort(pdts.begin(), pdts.end(),
+            [](const auto &a, const auto &b) { return a.Id < b.Id; });
+  return pdts;
+}
+
+TEST(Products, ReplicaAppliesChanges) {
+  ReplicatedProductStore store;
+  TaskQueue queue1, queue2;
+  auto *r1 = store.createReplica(queue1.executor());
+  auto *r2 = store.createReplica(queue2.executor());
+
+  int id = r1->createProduct(Product{0, "Volvo", "SUV"});
+  ASSERT_FALSE((bool)r2->getById(id)); // not applied yet
+  queue1.drain();
+  queue2.drain();
+  ASSERT_EQ(r1->getById(id)->Name, "Volvo");
+  ASSERT_EQ(r2->getById(id)->Name, "Volvo");
+
+  ASSERT_TRUE(r2->updateProduct(Product{id, "Volvo", "Truck"}));
+  ASSERT_FALSE(r2->updateProduct(Product{999, "abc", "def"}));
+  r2->deleteProduct(999);
+  queue1.drain();
+  queue2.drain();
+  ASSERT_EQ(r1->getById(id)->Description, "Truck");
+  ASSERT_EQ(store.getSeq(), (uint64_t)2);
+
+  r1->deleteProduct(id);
+  queue1.drain();
+  queue2.drain();
+  ASSERT_TRUE(r1->getAllProducts().empty());
+  ASSERT_TRUE(r2->getAllProducts().empty());
+}
+
+TEST(Products, ReplicaReadsOwnWrites) {
+  ReplicatedProductStore store;
+  TaskQueue queue1, queue2;
+  auto *r1 = store.createReplica(queue1.executor());
+  auto *r2 = store.createReplica(queue2.executor());
+
+  // Changes from the other replica are picked up along with our own.
+  int other = r2->createProduct(Product{0, "Toyota", "Camry"});
+  int id = r1->createProduct(Product{0, "Volvo", "SUV"});
+  ASSERT_EQ(r1->getById(id)->Name, "Volvo");
+  ASSERT_EQ(r1->getById(other)->Name, "Toyota");
+  ASSERT_FALSE((bool)r2->getById(id));
+
+  ASSERT_TRUE(r1->updateProduct(Product{id, "Volvo", "Truck"}));
+  ASSERT_EQ(r1->getById(id)->Description, "Truck");
+
+  r1->deleteProduct(other);
+  ASSERT_FALSE((bool)r1->getById(other));
+  ASSERT_EQ(r1->getAppliedSeq(), store.getSeq());
+
+  // Broadcast changes already applied while catching up are skipped.
+  queue1.drain();
+  queue2.drain();
+  ASSERT_EQ(sorted(r1->getAllProducts()), sorted(r2->getAllProducts()));
+  ASSERT_EQ(r2->getAppliedSeq(), store.getSeq());
+}
+
+TEST(Products, ReplicaSeededFromStore) {
+  ReplicatedProductStore store;
+  TaskQueue queue1, queue2;
+  auto *r1 = store.createReplica(queue1.executor());
+  r1->createProduct(Product{0, "Volvo", "SUV"});
+  r1->createProduct(Product{0, "Toyota", "Camry"});
+
+  auto *r2 = store.createReplica(queue2.executor());
+  ASSERT_EQ(r2->getAppliedSeq(), (uint64_t)2);
+  ASSERT_EQ(r2->getAllProducts().size(), (size_t)2);
+}
+
+TEST(Products, ReplicasConvergeUnderConcurrentWrites) {
+  const int numThreads = 4;
+  const int numWrites = 500;
+  ReplicatedProductStore store;
+  std::vector<TaskQueue> queues(numThreads);
+  std::vector<ProductReplica *> replicas;
+  for (auto &q : queues) {
+    replicas.push_back(store.createReplica(q.executor()));
+  }
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t]() {
+      auto *replica = replicas[t];
+      uint64_t lastSeq = 0;
+      for (int i = 0; i < numWrites; i++) {
+        int id = replica->createProduct(
+            Product{0, "thread" + std::to_string(t), std::to_string(i)});
+        ASSERT_TRUE((bool)replica->getById(id));
+        if (i % 3 == 0) {
+          replica->updateProduct(Product{id, "updated", std::to_string(i)});
+        }
+        if (i % 5 == 0) {
+          replica->deleteProduct(id);
+        }
+
+        if (i % 7 == 0) {
+          queues[t].drain();
+        }
+        ASSERT_GE(replica->getAppliedSeq(), lastSeq);
+        lastSeq = replica->getAppliedSeq();
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  for (auto &q : queues) {
+    q.drain();
+  }
+
+  TaskQueue fresh;
+  auto *seeded = store.createReplica(fresh.executor());
+  auto expected = sorted(seeded->getAllProducts());
+  ASSERT_EQ(expected.size(),
+            (size_t)(numThreads * (numWrites - numWrites / 5)));
+  for (auto *replica : replicas) {
+    ASSERT_EQ(replica->getAppliedSeq(), store.getSeq());
+    ASSERT_EQ(sorted(replica->getAllProducts()), expected);
+  }
+}
+
 } // namespace Products
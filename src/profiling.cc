@@ -0,0 +1,119 @@
+#include "profiling.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+namespace Profiling {
+
+static const auto epoch = std::chrono::steady_clock::now();
+
+static std::mutex registryMutex;
+static std::vector<std::shared_ptr<ThreadBuffer>> registry;
+static std::atomic<uint32_t> nextTid{0};
+
+void ThreadBuffer::record(const char *name, uint64_t startNs,
+                          uint64_t durationNs) {
+  auto i = this->written.load(std::memory_order_relaxed);
+  auto &slot = this->slots[i % Capacity];
+  // Pairs with the acquire fence in snapshot(): a reader that sees any of the
+  // stores below also sees written == i, and so knows the slot is in flux.
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.Name.store(name, std::memory_order_relaxed);
+  slot.StartNs.store(startNs, std::memory_order_relaxed);
+  slot.DurationNs.store(durationNs, std::memory_order_relaxed);
+  this->written.store(i + 1, std::memory_order_release);
+}
+
+std::vector<Event> ThreadBuffer::snapshot() const {
+  auto end = this->written.load(std::memory_order_acquire);
+  auto begin = std::max(end > Capacity ? end - Capacity : 0,
+                        this->cleared.load(std::memory_order_relaxed));
+
+  std::vector<Event> events;
+  events.reserve(end - std::min(begin, end));
+  for (auto i = begin; i < end; i++) {
+    const auto &slot = this->slots[i % Capacity];
+    events.push_back(Event{slot.Name.load(std::memory_order_relaxed),
+                           slot.StartNs.load(std::memory_order_relaxed),
+                           slot.DurationNs.load(std::memory_order_relaxed)});
+  }
+
+  // The writer may have started overwriting index `now` (slot now - Capacity)
+  // while we copied, so only slots after that one are known to be intact.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto now = this->written.load(std::memory_order_relaxed);
+  auto firstIntact = now >= Capacity ? now - Capacity + 1 : 0;
+  if (firstIntact > begin) {
+    events.erase(events.begin(),
+                 events.begin() + std::min(firstIntact - begin,
+                                           (uint64_t)events.size()));
+  }
+  return events;
+}
+
+void ThreadBuffer::clear() {
+  this->cleared.store(this->written.load(std::memory_order_acquire),
+                      std::memory_order_relaxed);
+}
+
+uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+ThreadBuffer &threadBuffer() {
+  // Registry keeps the buffer alive after the thread exits so its events can
+  // still be dumped.
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    auto b = std::make_shared<ThreadBuffer>(++nextTid);
+    std::lock_guard lock(registryMutex);
+    registry.push_back(b);
+    return b;
+  }();
+  return *buffer;
+}
+
+// Trace timestamps are in microseconds; keep full nanosecond precision.
+static void writeMicros(std::ostream &os, uint64_t ns) {
+  auto fill = os.fill('0');
+  os << ns / 1000 << "." << std::setw(3) << ns % 1000;
+  os.fill(fill);
+}
+
+void dumpChromeTrace(std::ostream &os) {
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    std::lock_guard lock(registryMutex);
+    buffers = registry;
+  }
+
+  auto pid = getpid();
+  bool first = true;
+  os << "{\"traceEvents\":[";
+  for (const auto &b : buffers) {
+    for (const auto &e : b->snapshot()) {
+      os << (first ? "" : ",") << "\n{\"name\":\"" << e.Name
+         << "\",\"cat\":\"cpphttp\",\"ph\":\"X\",\"ts\":";
+      writeMicros(os, e.StartNs);
+      os << ",\"dur\":";
+      writeMicros(os, e.DurationNs);
+      os << ",\"pid\":" << pid << ",\"tid\":" << b->getTid() << "}";
+      first = false;
+    }
+  }
+  os << "],\"displayTimeUnit\":\"ns\"}";
+}
+
+void reset() {
+  std::lock_guard lock(registryMutex);
+  for (const auto &b : registry) {
+    b->clear();
+  }
+}
+
+} // namespace Profiling
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace Profiling {
+
+struct Event {
+  const char *Name; // must point to a string literal
+  uint64_t StartNs;
+  uint64_t DurationNs;
+};
+
+// Fixed-size ring buffer written by a single thread without locking. Once
+// full, the oldest events are overwritten. Readers on other threads drop any
+// slot the writer may have overwritten while they were copying it.
+class ThreadBuffer {
+public:
+  static constexpr size_t Capacity = 8192;
+
+  explicit ThreadBuffer(uint32_t tid) : tid(tid) {}
+
+  void record(const char *name, uint64_t startNs, uint64_t durationNs);
+  std::vector<Event> snapshot() const;
+  void clear();
+
+  uint32_t getTid() const { return this->tid; }
+
+private:
+  struct Slot {
+    std::atomic<const char *> Name;
+    std::atomic<uint64_t> StartNs;
+    std::atomic<uint64_t> DurationNs;
+  };
+
+  std::array<Slot, Capacity> slots;
+  std::atomic<uint64_t> written{0}; // only stored by the owning thread
+  std::atomic<uint64_t> cleared{0}; // events before this index are dropped
+  uint32_t tid;
+};
+
+// Nanoseconds on a monotonic clock, relative to process start.
+uint64_t nowNs();
+
+// Buffer of the calling thread, registered on first use.
+ThreadBuffer &threadBuffer();
+
+// Writes the events of every registered thread in Chrome trace event format,
+// loadable in chrome://tracing or Perfetto.
+void dumpChromeTrace(std::ostream &os);
+
+void reset();
+
+class ScopedTimer {
+public:
+  explicit ScopedTimer(const char *name) : name(name), start(nowNs()) {}
+  ~ScopedTimer() { threadBuffer().record(name, start, nowNs() - start); }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  const char *name;
+  uint64_t start;
+};
+
+} // namespace Profiling
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Times the enclosing scope. Compiles to nothing unless built with
+// CPPHTTP_PROFILING (make PROFILING=1).
+#ifdef CPPHTTP_PROFILING
+#define PROFILE_SCOPE(name)                                                    \
+  ::Profiling::ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
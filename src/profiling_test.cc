@@ -0,0 +1,71 @@
+#include "profiling.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <thread>
+
+namespace Profiling {
+
+TEST(Profiling, ScopedTimerRecordsEvent) {
+  reset();
+  { ScopedTimer timer("test-scope"); }
+
+  auto events = threadBuffer().snapshot();
+  ASSERT_EQ(events.size(), (size_t)1);
+  ASSERT_STREQ(events[0].Name, "test-scope");
+  ASSERT_GE(nowNs(), events[0].StartNs + events[0].DurationNs);
+}
+
+TEST(Profiling, RingBufferKeepsMostRecent) {
+  ThreadBuffer buffer(1);
+  for (size_t i = 0; i < ThreadBuffer::Capacity + 10; i++) {
+    buffer.record("event", i, 1);
+  }
+
+  // The oldest slot is the next to be overwritten, so it is never reported.
+  auto events = buffer.snapshot();
+  ASSERT_EQ(events.size(), ThreadBuffer::Capacity - 1);
+  ASSERT_EQ(events.front().StartNs, (uint64_t)11);
+  ASSERT_EQ(events.back().StartNs, (uint64_t)ThreadBuffer::Capacity + 9);
+
+  buffer.clear();
+  ASSERT_TRUE(buffer.snapshot().empty());
+}
+
+TEST(Profiling, SnapshotWhileRecording) {
+  ThreadBuffer buffer(1);
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    for (uint64_t i = 0; !stop; i++) {
+      buffer.record("event", i, i);
+    }
+  });
+
+  for (int n = 0; n < 1000; n++) {
+    auto events = buffer.snapshot();
+    for (size_t i = 0; i < events.size(); i++) {
+      ASSERT_EQ(events[i].DurationNs, events[i].StartNs);
+      ASSERT_EQ(events[i].StartNs, events[0].StartNs + i);
+    }
+  }
+  stop = true;
+  writer.join();
+}
+
+TEST(Profiling, DumpChromeTrace) {
+  reset();
+  threadBuffer().record("main-thread", 1500, 2001);
+  std::thread([] { threadBuffer().record("worker-thread", 0, 1); }).join();
+
+  std::ostringstream os;
+  dumpChromeTrace(os);
+  auto trace = os.str();
+  ASSERT_EQ(trace.rfind("{\"traceEvents\":[", 0), (size_t)0);
+  ASSERT_NE(trace.find("\"name\":\"main-thread\""), std::string::npos);
+  ASSERT_NE(trace.find("\"ts\":1.500,\"dur\":2.001"), std::string::npos);
+  ASSERT_NE(trace.find("\"name\":\"worker-thread\""), std::string::npos);
+  ASSERT_NE(trace.find("\"tid\":" + std::to_string(threadBuffer().getTid())),
+            std::string::npos);
+}
+
+} // namespace Profiling
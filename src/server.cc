@@ -1,28 +1,81 @@
 #include "App.h"
+#include "assets.h"
 #include "http.h"
 #include "products.h"
 #include "spdlog/spdlog.h"
 #include "json/json.h"
 #include <algorithm>
+#include <cstring>
 #include <thread>
 
 #define PORT 6123
 
-int main() {
+int main(int argc, char **argv) {
   spdlog::set_level(spdlog::level::debug);
   spdlog::set_pattern("%b %d %H:%M:%S.%f [%t] [%l] %s - %v");
 
-  Products::ProductManager *pm = new Products::ProductManagerImpl();
+  // --replicated gives each worker its own copy of the products, kept in sync
+  // through change records deferred onto its loop. --root <dir> serves static
+  // files from dir instead of the working directory.
+  bool replicated = false;
+  std::filesystem::path root = ".";
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--replicated") == 0) {
+      replicated = true;
+    } else if (std::strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+      root = argv[++i];
+    } else {
+      SPDLOG_ERROR("Usage: {} [--replicated] [--root <dir>]", argv[0]);
+      return 1;
+    }
+  }
+
+  // Everything under the root is loaded into memory, so refuse to start from
+  // somewhere that is clearly not a webapp build.
+  if (!std::filesystem::is_regular_file(root / "index.html")) {
+    SPDLOG_ERROR("No index.html in {}; start from webapp/build or pass --root",
+                 std::filesystem::absolute(root).string());
+    return 1;
+  }
+
+  Products::ProductManager *shared = nullptr;
+  Products::ReplicatedProductStore *store = nullptr;
+  if (replicated) {
+    SPDLOG_INFO("Using per-thread product replicas");
+    store = new Products::ReplicatedProductStore();
+  } else {
+    shared = new Products::ProductManagerImpl();
+  }
+
+  // Reloads files as they change.
+  Assets::AssetCache *assets = new Assets::AssetCache(root);
+  if (!assets->watch()) {
+    SPDLOG_WARN("Static files will not be reloaded on change");
+  }
 
   std::vector<std::thread *> threads(std::thread::hardware_concurrency());
   std::transform(threads.begin(), threads.end(), threads.begin(), [=](auto *t) {
     return new std::thread([=]() {
-      Http::FsHandler<uWS::HttpResponse<false>, uWS::HttpRequest> fsHandler;
+      Products::ProductManager *pm = shared;
+      if (store) {
+        auto *loop = uWS::Loop::get();
+        pm = store->createReplica(
+            [loop](auto task) { loop->defer(std::move(task)); });
+      }
+
+      Http::FsHandler<uWS::HttpResponse<false>, uWS::HttpRequest> fsHandler(
+          assets);
       Http::ProductController<uWS::HttpResponse<false>, uWS::HttpRequest>
           pdtctrl(pm);
-      uWS::App()
-          .any("/api/v1/products/:action",
-               [&](auto *res, auto *req) { pdtctrl.handleRequest(res, req); })
+      uWS::App app;
+#ifdef CPPHTTP_PROFILING
+      Http::TraceController<uWS::HttpResponse<false>, uWS::HttpRequest>
+          tracectrl;
+      app.get("/admin/trace",
+              [&](auto *res, auto *req) { tracectrl.handleRequest(res, req); });
+#endif
+      app.any("/api/v1/products/:action",
+              [&](auto *res, auto *req) { pdtctrl.handleRequest(res, req); })
           .get("/*",
                [&](auto *res, auto *req) { fsHandler.handleRequest(res, req); })
           .listen(PORT,